@@ -28,7 +28,44 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_FORK,                   /* Duplicate this process. */
+    SYS_MADVISE,                /* Give access hints for memory. */
+    SYS_MSYNC,                  /* Write back a memory mapping. */
+    SYS_MMAP_RANGE,             /* Map part of a file into memory. */
+    SYS_MUNMAP_RANGE,           /* Remove part of memory mappings. */
+    SYS_VMSTAT,                 /* Report a process's memory use. */
+    SYS_RSS_LIMIT               /* Limit this process's resident set. */
+  };
+
+/* Advice for SYS_MADVISE. */
+#define MADV_NORMAL     0       /* No special treatment. */
+#define MADV_RANDOM     1       /* Random access: no readahead. */
+#define MADV_SEQUENTIAL 2       /* Sequential access: read ahead more,
+                                   drop pages already passed. */
+#define MADV_WILLNEED   3       /* Will be used soon: load now. */
+#define MADV_DONTNEED   4       /* Not needed: drop pages and swap. */
+
+/* Protection for SYS_MMAP_RANGE. */
+#define PROT_READ       1       /* Pages may be read. */
+#define PROT_WRITE      2       /* Pages may be written. */
+
+/* Flags for SYS_MSYNC. */
+#define MS_ASYNC        1       /* Leave it to the periodic flusher. */
+#define MS_SYNC         2       /* Write back before returning. */
+
+/* Memory use of a process, from SYS_VMSTAT.  Sizes are in
+   pages. */
+struct vmstat
+  {
+    unsigned faults;            /* Page faults taken. */
+    unsigned rss;               /* Resident pages mapped. */
+    unsigned rss_peak;          /* Most resident pages at once. */
+    unsigned rss_limit;         /* Limit on rss, 0 if none. */
+    unsigned wss;               /* Pages used in the last sample
+                                   period, 0 unless "-wss" is on. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -61,6 +61,26 @@
           retval;                                               \
         })
 
+/* Invokes syscall NUMBER, passing arguments ARG0 through ARG4,
+   and returns the return value as an `int'. */
+#define syscall5(NUMBER, ARG0, ARG1, ARG2, ARG3, ARG4)          \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg4]; pushl %[arg3]; pushl %[arg2]; "    \
+             "pushl %[arg1]; pushl %[arg0]; "                   \
+             "pushl %[number]; int $0x30; addl $24, %%esp"      \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [arg0] "g" (ARG0),                             \
+                 [arg1] "g" (ARG1),                             \
+                 [arg2] "g" (ARG2),                             \
+                 [arg3] "g" (ARG3),                             \
+                 [arg4] "g" (ARG4)                              \
+               : "memory");                                     \
+          retval;                                               \
+        })
+
 void
 halt (void) 
 {
@@ -182,3 +202,45 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
+int
+madvise (void *addr, unsigned length, int advice)
+{
+  return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+int
+msync (mapid_t mapid, int flags)
+{
+  return syscall2 (SYS_MSYNC, mapid, flags);
+}
+
+mapid_t
+mmap_range (int fd, void *addr, unsigned offset, unsigned length, int prot)
+{
+  return syscall5 (SYS_MMAP_RANGE, fd, addr, offset, length, prot);
+}
+
+int
+munmap_range (void *addr, unsigned length)
+{
+  return syscall2 (SYS_MUNMAP_RANGE, addr, length);
+}
+
+int
+vmstat (pid_t pid, struct vmstat *st)
+{
+  return syscall2 (SYS_VMSTAT, pid, st);
+}
+
+unsigned
+rss_limit (unsigned pages)
+{
+  return syscall1 (SYS_RSS_LIMIT, pages);
+}
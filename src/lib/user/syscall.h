@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <syscall-nr.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +46,14 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+pid_t fork (void);
+int madvise (void *addr, unsigned length, int advice);
+int msync (mapid_t, int flags);
+mapid_t mmap_range (int fd, void *addr, unsigned offset, unsigned length,
+                    int prot);
+int munmap_range (void *addr, unsigned length);
+int vmstat (pid_t, struct vmstat *);
+unsigned rss_limit (unsigned pages);
+
 #endif /* lib/user/syscall.h */
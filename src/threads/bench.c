@@ -0,0 +1,249 @@
+#include "threads/bench.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/cpu.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Kernel microbenchmarks, run with the "bench NAME" action.
+   Timings are taken with the time-stamp counter and reported in
+   CPU cycles, with interrupts off so that the timer does not
+   disturb them. */
+
+/* Largest buffer to benchmark over, in pages. */
+#define BENCH_MAX_PAGES 2048
+
+static void bench_kmap (void);
+static void bench_string (void);
+
+/* A benchmark. */
+struct bench
+  {
+    const char *name;           /* Name given to "bench". */
+    void (*function) (void);    /* Runs the benchmark. */
+  };
+
+/* Table of benchmarks. */
+static const struct bench benches[] =
+  {
+    {"kmap", bench_kmap},
+    {"string", bench_string},
+    {NULL, NULL},
+  };
+
+/* Runs the benchmark named in ARGV[1]. */
+void
+bench_run (char **argv)
+{
+  const char *name = argv[1];
+  const struct bench *b;
+
+  if ((cpu_features () & CPUID_TSC) == 0)
+    {
+      printf ("bench: CPU has no time-stamp counter\n");
+      return;
+    }
+
+  for (b = benches; b->name != NULL; b++)
+    if (!strcmp (name, b->name))
+      {
+        b->function ();
+        return;
+      }
+  PANIC ("unknown benchmark `%s'", name);
+}
+
+/* Obtains the largest kernel buffer of at most BENCH_MAX_PAGES
+   pages that is available, storing its size into *PAGE_CNT. */
+static uint8_t *
+get_buffer (size_t *page_cnt)
+{
+  size_t cnt;
+
+  for (cnt = BENCH_MAX_PAGES; cnt > 0; cnt /= 2)
+    {
+      uint8_t *buf = palloc_get_multiple (PAL_ZERO, cnt);
+      if (buf != NULL)
+        {
+          *page_cnt = cnt;
+          return buf;
+        }
+    }
+  PANIC ("bench: out of kernel pages");
+}
+
+/* Streams over a large buffer in the kernel's direct map of
+   RAM, first touching one word per page, which is dominated by
+   TLB misses when RAM is mapped with 4 kB pages, and then
+   reading every word.  Compare runs with and without the
+   "-nopse" option. */
+static void
+bench_kmap (void)
+{
+  enum { ROUNDS = 16 };
+  size_t page_cnt, size, i;
+  int round;
+  volatile uint32_t sum = 0;
+  uint64_t start, touch_cycles, stream_cycles;
+  enum intr_level old_level;
+  uint8_t *buf = get_buffer (&page_cnt);
+
+  size = page_cnt * PGSIZE;
+  old_level = intr_disable ();
+
+  start = rdtsc ();
+  for (round = 0; round < ROUNDS; round++)
+    for (i = 0; i < size; i += PGSIZE)
+      sum += *(uint32_t *) (buf + i);
+  touch_cycles = rdtsc () - start;
+
+  start = rdtsc ();
+  for (round = 0; round < ROUNDS; round++)
+    for (i = 0; i < size; i += sizeof (uint32_t))
+      sum += *(uint32_t *) (buf + i);
+  stream_cycles = rdtsc () - start;
+
+  intr_set_level (old_level);
+  palloc_free_multiple (buf, page_cnt);
+
+  printf ("kmap: %s pages, %zu kB buffer\n",
+          init_large_pages ? "4 MB" : "4 kB", size / 1024);
+  printf ("kmap: page touch: %"PRIu64" cycles/page\n",
+          touch_cycles / (ROUNDS * page_cnt));
+  printf ("kmap: stream: %"PRIu64" cycles/kB\n",
+          stream_cycles / (ROUNDS * size / 1024));
+}
+
+/* Byte-at-a-time reference versions of the lib/string.c block
+   functions, as they were before those went word-wide. */
+
+static void *
+byte_memcpy (void *dst_, const void *src_, size_t size)
+{
+  unsigned char *dst = dst_;
+  const unsigned char *src = src_;
+
+  while (size-- > 0)
+    *dst++ = *src++;
+  return dst_;
+}
+
+static void *
+byte_memmove (void *dst_, const void *src_, size_t size)
+{
+  unsigned char *dst = dst_;
+  const unsigned char *src = src_;
+
+  if (dst < src)
+    while (size-- > 0)
+      *dst++ = *src++;
+  else
+    {
+      dst += size;
+      src += size;
+      while (size-- > 0)
+        *--dst = *--src;
+    }
+  return dst_;
+}
+
+static void *
+byte_memset (void *dst_, int value, size_t size)
+{
+  unsigned char *dst = dst_;
+
+  while (size-- > 0)
+    *dst++ = value;
+  return dst_;
+}
+
+static int
+byte_memcmp (const void *a_, const void *b_, size_t size)
+{
+  const unsigned char *a = a_;
+  const unsigned char *b = b_;
+
+  for (; size-- > 0; a++, b++)
+    if (*a != *b)
+      return *a > *b ? +1 : -1;
+  return 0;
+}
+
+/* Block operations to compare. */
+enum string_op { OP_MEMCPY, OP_MEMMOVE, OP_MEMSET, OP_MEMCMP, OP_CNT };
+static const char *op_names[OP_CNT] =
+  { "memcpy", "memmove", "memset", "memcmp" };
+
+/* Runs OP on SIZE bytes of the buffers at DST and SRC ITERS
+   times, using the byte-wise version if BYTEWISE, and returns
+   the average number of cycles per call. */
+static uint64_t
+time_string_op (enum string_op op, bool bytewise, uint8_t *dst,
+                uint8_t *src, size_t size, size_t iters)
+{
+  uint64_t start;
+  size_t i;
+
+  start = rdtsc ();
+  for (i = 0; i < iters; i++)
+    switch (op)
+      {
+      case OP_MEMCPY:
+        (bytewise ? byte_memcpy : memcpy) (dst + 1, src + 3, size);
+        break;
+      case OP_MEMMOVE:
+        /* Overlapping, so that it must copy downward. */
+        (bytewise ? byte_memmove : memmove) (src + 5, src, size);
+        break;
+      case OP_MEMSET:
+        (bytewise ? byte_memset : memset) (dst + 1, i, size);
+        break;
+      case OP_MEMCMP:
+        (bytewise ? byte_memcmp : memcmp) (dst, src, size);
+        break;
+      default:
+        NOT_REACHED ();
+      }
+  return (rdtsc () - start) / iters;
+}
+
+/* Compares the word-wide lib/string.c block functions against
+   byte-at-a-time loops for sizes from 8 bytes to 64 kB, with
+   misaligned buffers. */
+static void
+bench_string (void)
+{
+  enum { MAX_SIZE = 64 * 1024, BUF_PAGES = MAX_SIZE / PGSIZE + 1 };
+  uint8_t *dst = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, BUF_PAGES);
+  uint8_t *src = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, BUF_PAGES);
+  enum intr_level old_level;
+  size_t size;
+  int op;
+
+  printf ("string: size  op       bytewise  word-wide (cycles/call)\n");
+  for (size = 8; size <= MAX_SIZE; size *= 2)
+    for (op = 0; op < OP_CNT; op++)
+      {
+        size_t iters = MAX_SIZE * 4 / size;
+        uint64_t old_cycles, new_cycles;
+
+        /* Make memcmp() scan the whole block. */
+        if (op == OP_MEMCMP)
+          memcpy (dst, src, size);
+
+        old_level = intr_disable ();
+        old_cycles = time_string_op (op, true, dst, src, size, iters);
+        new_cycles = time_string_op (op, false, dst, src, size, iters);
+        intr_set_level (old_level);
+
+        printf ("string: %5zu %-8s %9"PRIu64" %10"PRIu64"\n",
+                size, op_names[op], old_cycles, new_cycles);
+      }
+
+  palloc_free_multiple (src, BUF_PAGES);
+  palloc_free_multiple (dst, BUF_PAGES);
+}
@@ -0,0 +1,62 @@
+#ifndef THREADS_CPU_H
+#define THREADS_CPU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/flags.h"
+
+/* Feature bits returned in EDX by CPUID leaf 1.
+   See [IA32-v2a] "CPUID". */
+#define CPUID_PSE  0x00000008   /* 4 MB pages. */
+#define CPUID_TSC  0x00000010   /* Time-stamp counter. */
+
+/* CR4 bits.  See [IA32-v3a] 2.5 "Control Registers". */
+#define CR4_PSE 0x00000010      /* Page Size Extensions. */
+
+/* Returns the CPUID leaf 1 EDX feature bits, or 0 if the CPU
+   does not support the CPUID instruction. */
+static inline uint32_t
+cpu_features (void)
+{
+  uint32_t before, after, eax, ebx, ecx, edx;
+
+  /* CPUID is supported if software can toggle EFLAGS.ID. */
+  asm volatile ("pushfl; popl %0; movl %0, %1; xorl %2, %1;"
+                "pushl %1; popfl; pushfl; popl %1; pushl %0; popfl"
+                : "=&r" (before), "=&r" (after) : "i" (FLAG_ID));
+  if (((before ^ after) & FLAG_ID) == 0)
+    return 0;
+
+  asm volatile ("cpuid"
+                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  return edx;
+}
+
+/* Returns the contents of CR4. */
+static inline uint32_t
+cr4_read (void)
+{
+  uint32_t cr4;
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  return cr4;
+}
+
+/* Stores CR4 into the CR4 register. */
+static inline void
+cr4_write (uint32_t cr4)
+{
+  asm volatile ("movl %0, %%cr4" : : "r" (cr4) : "memory");
+}
+
+/* Returns the time-stamp counter.  Check for CPUID_TSC before
+   using it. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+#endif /* threads/cpu.h */
@@ -15,10 +15,13 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/bench.h"
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
+#include "threads/memstat.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
@@ -29,6 +32,10 @@
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "vm/swap.h"
+#ifdef VM
+#include "vm/page.h"
+#include "vm/zswap.h"
+#endif
 #else
 #include "tests/threads/tests.h"
 #endif
@@ -42,6 +49,15 @@
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
 
+/* True if init_page_dir maps RAM with 4 MB pages. */
+bool init_large_pages;
+
+/* True if CR4.PSE is set, so that PDEs may map 4 MB pages. */
+bool init_pse;
+
+/* -nopse: Map RAM with 4 kB pages only? */
+static bool no_large_pages;
+
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
@@ -58,6 +74,9 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* -kr: Free pages the kernel pool never lends to the user pool. */
+static size_t kernel_reserve = SIZE_MAX;
+
 static void bss_init (void);
 static void paging_init (void);
 
@@ -96,8 +115,9 @@ main (void)
           init_ram_pages * PGSIZE / 1024);
 
   /* Initialize memory system. */
-  palloc_init (user_page_limit);
+  palloc_init (user_page_limit, kernel_reserve);
   malloc_init ();
+  memstat_init ();
   paging_init ();
 
   /* Segmentation. */
@@ -130,6 +150,11 @@ main (void)
 
   lru_init();
   swap_init();
+#ifdef VM
+  pageout_init ();
+  flusher_init ();
+  ws_init ();
+#endif
 
   printf ("Boot complete.\n");
   
@@ -157,13 +182,28 @@ bss_init (void)
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU supports PSE, each 4 MB stretch of RAM that does
+   not contain kernel text (which must stay read-only) is mapped
+   with a single 4 MB page instead of a page table.  That saves
+   the page table and lets one TLB entry cover the whole
+   stretch. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  bool use_pse = !no_large_pages && (cpu_features () & CPUID_PSE) != 0;
+
+  /* Turn on 4 MB page support before any PDE uses it.  See
+     [IA32-v3a] 3.6.1 "Paging Options". */
+  if (use_pse)
+    {
+      cr4_write (cr4_read () | CR4_PSE);
+      init_pse = true;
+    }
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -175,6 +215,16 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (use_pse && pte_idx == 0
+          && page + PTSPAN / PGSIZE <= init_ram_pages
+          && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_large (vaddr, true);
+          init_large_pages = true;
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
@@ -260,9 +310,40 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-nopse"))
+        no_large_pages = true;
+      else if (!strcmp (name, "-memstat"))
+        memstat_enabled = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-kr"))
+        kernel_reserve = atoi (value);
+      else if (!strcmp (name, "-stack"))
+        stack_limit = (size_t) atoi (value) * 1024;
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-vmpolicy"))
+        {
+          if (!vm_set_policy (value))
+            PANIC ("unknown page replacement policy `%s'", value);
+        }
+      else if (!strcmp (name, "-zswap"))
+        zswap_pages = atoi (value);
+      else if (!strcmp (name, "-faultaround"))
+        fault_around_pages = atoi (value);
+      else if (!strcmp (name, "-flush"))
+        flush_secs = atoi (value);
+      else if (!strcmp (name, "-nosuperpage"))
+        superpage_enabled = false;
+      else if (!strcmp (name, "-rss"))
+        {
+          size_t pages = atoi (value);
+          thread_current ()->rss_limit =
+            pages != 0 && pages < RSS_LIMIT_MIN ? RSS_LIMIT_MIN : pages;
+        }
+      else if (!strcmp (name, "-wss"))
+        ws_secs = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -313,6 +394,7 @@ run_actions (char **argv)
   static const struct action actions[] = 
     {
       {"run", 2, run_task},
+      {"bench", 2, bench_run},
 #ifdef FILESYS
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
@@ -361,6 +443,7 @@ usage (void)
 #else
           "  run TEST           Run TEST.\n"
 #endif
+          "  bench NAME         Run kernel microbenchmark NAME.\n"
 #ifdef FILESYS
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
@@ -383,8 +466,27 @@ usage (void)
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -nopse             Use 4 kB pages only, for kernel and user.\n"
+          "  -memstat           Account kernel memory, report leaks.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -kr=COUNT          Keep COUNT free pages for the kernel.\n"
+          "  -stack=KB          Let user stacks grow to KB kB (8192).\n"
+#endif
+#ifdef VM
+          "  -vmpolicy=NAME     Replace pages by NAME: clock (default),\n"
+          "                     clock2 (two-handed clock), or clockpro.\n"
+          "  -zswap=PAGES       Keep up to PAGES pages of compressed swap.\n"
+          "  -faultaround=PAGES Map faults in windows of PAGES pages (8),\n"
+          "                     0 to map only the page faulted.\n"
+          "  -flush=SECS        Write back mapped files every SECS seconds\n"
+          "                     (5), 0 to write them only at munmap.\n"
+          "  -nosuperpage       Map user memory with 4 kB pages only.\n"
+          "  -rss=PAGES         Make each process evict its own pages\n"
+          "                     beyond PAGES resident (0, no limit;\n"
+          "                     at least 32).\n"
+          "  -wss=SECS          Sample working sets every SECS seconds\n"
+          "                     (0, off), for vmstat().\n"
 #endif
           );
   shutdown_power_off ();
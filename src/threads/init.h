@@ -9,4 +9,10 @@
 /* Page directory with kernel mappings only. */
 extern uint32_t *init_page_dir;
 
+/* True if init_page_dir maps RAM with 4 MB pages. */
+extern bool init_large_pages;
+
+/* True if CR4.PSE is set, so that PDEs may map 4 MB pages. */
+extern bool init_pse;
+
 #endif /* threads/init.h */
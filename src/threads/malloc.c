@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/memstat.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -64,6 +65,8 @@ struct block
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+static void *get_block (size_t size);
+static size_t block_size (void *block);
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
 
@@ -88,6 +91,17 @@ malloc_init (void)
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) 
+{
+  void *p = get_block (size);
+  if (p != NULL)
+    memstat_alloc (MEMSTAT_BYTES, p, block_size (p),
+                   __builtin_return_address (0));
+  return p;
+}
+
+/* Implements malloc(), without memory accounting. */
+static void *
+get_block (size_t size) 
 {
   struct desc *d;
   struct block *b;
@@ -167,9 +181,13 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = get_block (size);
   if (p != NULL)
-    memset (p, 0, size);
+    {
+      memset (p, 0, size);
+      memstat_alloc (MEMSTAT_BYTES, p, block_size (p),
+                     __builtin_return_address (0));
+    }
 
   return p;
 }
@@ -190,7 +208,13 @@ block_size (void *block)
    If successful, returns the new block; on failure, returns a
    null pointer.
    A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
-   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK).
+
+   OLD_BLOCK is returned unchanged if NEW_SIZE still fits in it.
+   A big block is resized in place where possible: surplus
+   trailing pages are returned to the page allocator when it
+   shrinks, and it grows into the following pages if they are
+   free. */
 void *
 realloc (void *old_block, size_t new_size) 
 {
@@ -199,15 +223,59 @@ realloc (void *old_block, size_t new_size)
       free (old_block);
       return NULL;
     }
+  else if (old_block == NULL)
+    {
+      void *new_block = get_block (new_size);
+      if (new_block != NULL)
+        memstat_alloc (MEMSTAT_BYTES, new_block, block_size (new_block),
+                       __builtin_return_address (0));
+      return new_block;
+    }
   else 
     {
-      void *new_block = malloc (new_size);
-      if (old_block != NULL && new_block != NULL)
+      size_t old_size = block_size (old_block);
+      struct arena *a = block_to_arena (old_block);
+      void *new_block;
+
+      if (a->desc != NULL)
+        {
+          /* Small block: keep it if its size class still fits. */
+          if (new_size <= old_size)
+            return old_block;
+        }
+      else if (new_size > descs[desc_cnt - 1].block_size)
+        {
+          /* Big block that is still too big for the largest
+             descriptor: resize its run of pages in place. */
+          size_t page_cnt = DIV_ROUND_UP (new_size + sizeof *a, PGSIZE);
+
+          if (page_cnt <= a->free_cnt)
+            {
+              memstat_resize (MEMSTAT_PAGES, a, page_cnt);
+              palloc_free_multiple ((uint8_t *) a + page_cnt * PGSIZE,
+                                    a->free_cnt - page_cnt);
+              a->free_cnt = page_cnt;
+              memstat_resize (MEMSTAT_BYTES, old_block,
+                              block_size (old_block));
+              return old_block;
+            }
+          if (palloc_extend_multiple (a, a->free_cnt, page_cnt))
+            {
+              a->free_cnt = page_cnt;
+              memstat_resize (MEMSTAT_BYTES, old_block,
+                              block_size (old_block));
+              return old_block;
+            }
+        }
+
+      new_block = get_block (new_size);
+      if (new_block != NULL)
         {
-          size_t old_size = block_size (old_block);
           size_t min_size = new_size < old_size ? new_size : old_size;
           memcpy (new_block, old_block, min_size);
           free (old_block);
+          memstat_alloc (MEMSTAT_BYTES, new_block, block_size (new_block),
+                         __builtin_return_address (0));
         }
       return new_block;
     }
@@ -223,6 +291,8 @@ free (void *p)
       struct block *b = p;
       struct arena *a = block_to_arena (b);
       struct desc *d = a->desc;
+
+      memstat_free (MEMSTAT_BYTES, p);
       
       if (d != NULL) 
         {
@@ -0,0 +1,408 @@
+#include "threads/memstat.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Kernel memory accounting.
+
+   When enabled with "-memstat", palloc() and malloc() report
+   every allocation and free here.  Each allocation is charged
+   to its call site (the return address of the public allocator
+   entry point) and to the thread that made it, and high-water
+   marks are kept for both as well as globally.  At shutdown
+   memstat_print_stats() lists the allocations still outstanding,
+   grouped by call site; feed the addresses to the "backtrace"
+   utility to turn them into function names.
+
+   The bookkeeping lives entirely in a side table indexed by the
+   allocated address, never inside the allocated memory, so the
+   0xcc poisoning that palloc_free_multiple() and free() do when
+   NDEBUG is not defined cannot disturb it.  The table is a fixed
+   number of pages taken from the kernel pool at startup.  If it
+   fills up, further allocations are counted as untracked rather
+   than failing. */
+
+/* Pages of kernel pool memory used for the allocation table. */
+#define REC_PAGES 32
+
+/* Maximum number of distinct call sites.  The last slot also
+   collects any sites beyond that. */
+#define SITE_CNT 128
+
+/* One outstanding allocation. */
+struct alloc_rec
+  {
+    const void *ptr;            /* Allocated address, null if slot empty. */
+    size_t size;                /* Pages or bytes, per KIND. */
+    tid_t owner;                /* Thread charged for the allocation. */
+    uint8_t kind;               /* enum memstat_kind. */
+    uint8_t site;               /* Index into sites[]. */
+  };
+
+/* Per-call-site counters. */
+struct alloc_site
+  {
+    const void *addr;           /* Return address, null if slot empty. */
+    enum memstat_kind kind;     /* What SIZE counters measure. */
+    size_t alloc_cnt;           /* Allocations ever made here. */
+    size_t live_cnt;            /* Allocations outstanding. */
+    size_t live_size;           /* Pages or bytes outstanding. */
+    size_t peak_size;           /* High-water mark of LIVE_SIZE. */
+  };
+
+/* Global counters, indexed by enum memstat_kind. */
+struct alloc_totals
+  {
+    size_t live_size;           /* Pages or bytes outstanding. */
+    size_t peak_size;           /* High-water mark of LIVE_SIZE. */
+    size_t untracked_cnt;       /* Allocations that missed the table. */
+  };
+
+bool memstat_enabled;
+
+static struct alloc_rec *recs;  /* Open-addressed allocation table. */
+static size_t rec_mask;         /* Number of slots in RECS, minus 1. */
+static struct alloc_site sites[SITE_CNT];
+static struct alloc_totals totals[2];
+
+static const char *kind_unit[] = { "pages", "bytes" };
+
+static size_t rec_hash (enum memstat_kind, const void *);
+static struct alloc_rec *rec_find (enum memstat_kind, const void *);
+static void rec_remove (struct alloc_rec *);
+static uint8_t site_lookup (enum memstat_kind, const void *site);
+static void charge (enum memstat_kind, tid_t, size_t add, size_t sub);
+
+/* Sets up the allocation table.  Must be called after
+   palloc_init() and before any allocation that should be
+   accounted. */
+void
+memstat_init (void)
+{
+  size_t slots;
+
+  if (!memstat_enabled)
+    return;
+
+  recs = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, REC_PAGES);
+
+  /* Use the largest power of 2 number of slots that fits. */
+  slots = REC_PAGES * PGSIZE / sizeof *recs;
+  while (slots & (slots - 1))
+    slots &= slots - 1;
+  rec_mask = slots - 1;
+}
+
+/* Records that SIZE pages or bytes, per KIND, were allocated at
+   P by the code that returns to SITE. */
+void
+memstat_alloc (enum memstat_kind kind, const void *p, size_t size,
+               const void *site)
+{
+  enum intr_level old_level;
+  struct alloc_rec *r;
+  struct alloc_site *s;
+  struct alloc_totals *t = &totals[kind];
+  tid_t owner = thread_tid ();
+  size_t start, i;
+
+  if (recs == NULL || p == NULL)
+    return;
+
+  old_level = intr_disable ();
+
+  /* Find an empty slot. */
+  r = NULL;
+  start = i = rec_hash (kind, p);
+  do
+    {
+      if (recs[i].ptr == NULL)
+        {
+          r = &recs[i];
+          break;
+        }
+      i = (i + 1) & rec_mask;
+    }
+  while (i != start);
+
+  if (r != NULL)
+    {
+      r->ptr = p;
+      r->size = size;
+      r->owner = owner;
+      r->kind = kind;
+      r->site = site_lookup (kind, site);
+
+      s = &sites[r->site];
+      s->alloc_cnt++;
+      s->live_cnt++;
+      s->live_size += size;
+      if (s->live_size > s->peak_size)
+        s->peak_size = s->live_size;
+
+      t->live_size += size;
+      if (t->live_size > t->peak_size)
+        t->peak_size = t->live_size;
+
+      charge (kind, owner, size, 0);
+    }
+  else
+    t->untracked_cnt++;
+
+  intr_set_level (old_level);
+}
+
+/* Records that the allocation at P, if it is being tracked, now
+   has size NEW_SIZE. */
+void
+memstat_resize (enum memstat_kind kind, const void *p, size_t new_size)
+{
+  enum intr_level old_level;
+  struct alloc_rec *r;
+
+  if (recs == NULL || p == NULL)
+    return;
+
+  old_level = intr_disable ();
+  r = rec_find (kind, p);
+  if (r != NULL)
+    {
+      struct alloc_site *s = &sites[r->site];
+      struct alloc_totals *t = &totals[kind];
+
+      s->live_size += new_size - r->size;
+      t->live_size += new_size - r->size;
+      if (s->live_size > s->peak_size)
+        s->peak_size = s->live_size;
+      if (t->live_size > t->peak_size)
+        t->peak_size = t->live_size;
+      if (new_size > r->size)
+        charge (kind, r->owner, new_size - r->size, 0);
+      else
+        charge (kind, r->owner, 0, r->size - new_size);
+      r->size = new_size;
+    }
+  intr_set_level (old_level);
+}
+
+/* Records that the allocation at P was freed.  Allocations that
+   are not being tracked are ignored. */
+void
+memstat_free (enum memstat_kind kind, const void *p)
+{
+  enum intr_level old_level;
+  struct alloc_rec *r;
+
+  if (recs == NULL || p == NULL)
+    return;
+
+  old_level = intr_disable ();
+  r = rec_find (kind, p);
+  if (r != NULL)
+    {
+      struct alloc_site *s = &sites[r->site];
+
+      s->live_cnt--;
+      s->live_size -= r->size;
+      totals[kind].live_size -= r->size;
+      charge (kind, r->owner, 0, r->size);
+      rec_remove (r);
+    }
+  intr_set_level (old_level);
+}
+
+/* Prints a thread's accounting line.  Used via thread_foreach(). */
+static void
+print_thread (struct thread *t, void *aux UNUSED)
+{
+  if (t->mem_pages_peak != 0 || t->mem_bytes_peak != 0)
+    printf ("  thread %d (%s): %zu pages (peak %zu), "
+            "%zu bytes (peak %zu)\n",
+            t->tid, t->name, t->mem_pages, t->mem_pages_peak,
+            t->mem_bytes, t->mem_bytes_peak);
+}
+
+/* Prints the accounting report: global totals, live threads,
+   and the allocations still outstanding by call site. */
+void
+memstat_print_stats (void)
+{
+  enum intr_level old_level;
+  int kind;
+  size_t i;
+
+  if (recs == NULL)
+    return;
+
+  old_level = intr_disable ();
+
+  printf ("Memory: ");
+  for (kind = MEMSTAT_PAGES; kind <= MEMSTAT_BYTES; kind++)
+    printf ("%zu %s outstanding (peak %zu, %zu untracked)%s",
+            totals[kind].live_size, kind_unit[kind],
+            totals[kind].peak_size, totals[kind].untracked_cnt,
+            kind == MEMSTAT_PAGES ? ", " : "\n");
+
+  thread_foreach (print_thread, NULL);
+
+  for (i = 0; i < SITE_CNT; i++)
+    {
+      struct alloc_site *s = &sites[i];
+      if (s->addr != NULL && s->live_cnt > 0)
+        printf ("  leak: %p: %zu of %zu allocations, "
+                "%zu %s outstanding (peak %zu)\n",
+                s->addr, s->live_cnt, s->alloc_cnt,
+                s->live_size, kind_unit[s->kind], s->peak_size);
+    }
+
+  intr_set_level (old_level);
+}
+
+/* Returns the preferred table slot for P. */
+static size_t
+rec_hash (enum memstat_kind kind, const void *p)
+{
+  uint32_t x = (uintptr_t) p ^ kind;
+  x ^= x >> 16;
+  x *= 0x45d9f3b;
+  x ^= x >> 16;
+  return x & rec_mask;
+}
+
+/* Returns the record for P, or a null pointer if P is not being
+   tracked. */
+static struct alloc_rec *
+rec_find (enum memstat_kind kind, const void *p)
+{
+  size_t start = rec_hash (kind, p);
+  size_t i = start;
+
+  do
+    {
+      if (recs[i].ptr == NULL)
+        return NULL;
+      if (recs[i].ptr == p && recs[i].kind == kind)
+        return &recs[i];
+      i = (i + 1) & rec_mask;
+    }
+  while (i != start);
+  return NULL;
+}
+
+/* Empties slot R, moving later members of its probe run back so
+   that lookups never stop early at the hole. */
+static void
+rec_remove (struct alloc_rec *r)
+{
+  size_t i = r - recs;
+  size_t j = i;
+
+  recs[i].ptr = NULL;
+  for (;;)
+    {
+      size_t k;
+
+      j = (j + 1) & rec_mask;
+      if (recs[j].ptr == NULL)
+        break;
+
+      /* Leave J where it is if its home slot K lies cyclically
+         in (I, J]. */
+      k = rec_hash (recs[j].kind, recs[j].ptr);
+      if (i <= j ? i < k && k <= j : i < k || k <= j)
+        continue;
+
+      recs[i] = recs[j];
+      recs[j].ptr = NULL;
+      i = j;
+    }
+}
+
+/* Returns the index of the counters for call site SITE,
+   creating them if necessary. */
+static uint8_t
+site_lookup (enum memstat_kind kind, const void *site)
+{
+  size_t start = ((uintptr_t) site >> 2) % (SITE_CNT - 1);
+  size_t i = start;
+
+  do
+    {
+      struct alloc_site *s = &sites[i];
+      if (s->addr == NULL)
+        {
+          s->addr = site;
+          s->kind = kind;
+          return i;
+        }
+      if (s->addr == site && s->kind == kind)
+        return i;
+      i = (i + 1) % (SITE_CNT - 1);
+    }
+  while (i != start);
+
+  /* Out of slots: lump everything else together. */
+  sites[SITE_CNT - 1].kind = kind;
+  return SITE_CNT - 1;
+}
+
+/* Arguments to charge_thread(). */
+struct charge_aux
+  {
+    tid_t tid;
+    enum memstat_kind kind;
+    size_t add, sub;
+  };
+
+/* Applies AUX_ to T if T is the thread it names.  Used via
+   thread_foreach(). */
+static void
+charge_thread (struct thread *t, void *aux_)
+{
+  struct charge_aux *aux = aux_;
+  size_t *live, *peak;
+
+  if (t->tid != aux->tid)
+    return;
+
+  if (aux->kind == MEMSTAT_PAGES)
+    {
+      live = &t->mem_pages;
+      peak = &t->mem_pages_peak;
+    }
+  else
+    {
+      live = &t->mem_bytes;
+      peak = &t->mem_bytes_peak;
+    }
+
+  *live += aux->add;
+  *live -= aux->sub < *live ? aux->sub : *live;
+  if (*live > *peak)
+    *peak = *live;
+}
+
+/* Adjusts the counters of the thread with tid TID, if it still
+   exists, by adding ADD and subtracting SUB. */
+static void
+charge (enum memstat_kind kind, tid_t tid, size_t add, size_t sub)
+{
+  struct charge_aux aux;
+
+  aux.tid = tid;
+  aux.kind = kind;
+  aux.add = add;
+  aux.sub = sub;
+
+  /* Usually it is the running thread; avoid the list walk. */
+  if (thread_tid () == tid)
+    charge_thread (thread_current (), &aux);
+  else
+    thread_foreach (charge_thread, &aux);
+}
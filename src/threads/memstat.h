@@ -0,0 +1,24 @@
+#ifndef THREADS_MEMSTAT_H
+#define THREADS_MEMSTAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* What an accounted allocation is measured in. */
+enum memstat_kind
+  {
+    MEMSTAT_PAGES,              /* palloc(): size is a page count. */
+    MEMSTAT_BYTES               /* malloc(): size is a byte count. */
+  };
+
+/* Controlled by kernel command-line option "-memstat". */
+extern bool memstat_enabled;
+
+void memstat_init (void);
+void memstat_alloc (enum memstat_kind, const void *, size_t size,
+                    const void *site);
+void memstat_resize (enum memstat_kind, const void *, size_t new_size);
+void memstat_free (enum memstat_kind, const void *);
+void memstat_print_stats (void);
+
+#endif /* threads/memstat.h */
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/loader.h"
+#include "threads/memstat.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -22,43 +23,103 @@
    even if user processes are swapping like mad.
 
    By default, half of system RAM is given to the kernel pool and
-   half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   half to the user pool to start with.  The split is not fixed:
+   when one pool runs dry it borrows a range of free pages from
+   the other, so a memory-hungry user workload can grow the user
+   pool before it has to start evicting, and the kernel takes
+   free pages back when its own demand rises.  The kernel pool
+   never lends away pages that would leave it with fewer free
+   pages than its reserve, and the user pool never grows past
+   the user page limit.
+
+   Both pools' bitmaps span all of free memory.  A page owned by
+   the other pool is simply marked used in a pool's bitmap, so
+   allocation within a pool works exactly as before; a separate
+   ownership bitmap records which pool each page belongs to. */
 
 /* A memory pool. */
 struct pool
   {
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
-    uint8_t *base;                      /* Base of pool. */
+    size_t owned_cnt;                   /* Pages owned by this pool. */
+    size_t free_cnt;                    /* Owned pages not in use. */
+    size_t max_cnt;                     /* Limit on OWNED_CNT. */
+    size_t reserve_cnt;                 /* Free pages never lent. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
-static void init_pool (struct pool *, void *base, size_t page_cnt,
-                       const char *name);
-static bool page_from_pool (const struct pool *, void *page);
+/* Pages managed by the pools, and which pool owns each one:
+   true for the user pool, false for the kernel pool.  Changes
+   only with both pools' locks held. */
+static uint8_t *pool_base;
+static struct bitmap *user_owned_map;
+
+/* Minimum number of pages moved by one loan, to keep borrowing
+   rare. */
+#define LOAN_PAGES 16
+
+static void *get_multiple (enum palloc_flags, size_t page_cnt,
+                           const void *site);
+static size_t take_pages (struct pool *, size_t page_cnt);
+static size_t take_aligned (struct pool *, size_t page_cnt);
+static bool borrow_pages (struct pool *to, struct pool *from,
+                          size_t page_cnt);
+static void init_pool (struct pool *, size_t page_cnt, size_t first,
+                       size_t cnt, const char *name);
+static struct pool *page_to_pool (void *page, size_t *page_idx);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
-   pages are put into the user pool. */
+   pages are put into the user pool.  The kernel pool keeps at
+   least KERNEL_RESERVE pages free for itself; SIZE_MAX selects
+   a quarter of its initial size. */
 void
-palloc_init (size_t user_page_limit)
+palloc_init (size_t user_page_limit, size_t kernel_reserve)
 {
   /* Free memory starts at 1 MB and runs to the end of RAM. */
   uint8_t *free_start = ptov (1024 * 1024);
   uint8_t *free_end = ptov (init_ram_pages * PGSIZE);
   size_t free_pages = (free_end - free_start) / PGSIZE;
-  size_t user_pages = free_pages / 2;
-  size_t kernel_pages;
+  size_t bm_size = bitmap_buf_size (free_pages);
+  size_t bm_pages = DIV_ROUND_UP (3 * bm_size, PGSIZE);
+  size_t page_cnt, user_pages, kernel_pages;
+
+  /* We'll put the bitmaps at the start of free memory.
+     Calculate the space needed for them and subtract it from
+     the pages available. */
+  if (bm_pages >= free_pages)
+    PANIC ("Not enough memory for page allocator bitmaps.");
+  page_cnt = free_pages - bm_pages;
+  pool_base = free_start + bm_pages * PGSIZE;
+
+  /* Give half of memory to kernel, half to user. */
+  user_pages = page_cnt / 2;
   if (user_pages > user_page_limit)
     user_pages = user_page_limit;
-  kernel_pages = free_pages - user_pages;
+  kernel_pages = page_cnt - user_pages;
 
-  /* Give half of memory to kernel, half to user. */
-  init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
-  init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
-             user_pages, "user pool");
+  kernel_pool.used_map = bitmap_create_in_buf (page_cnt, free_start,
+                                               bm_size);
+  user_pool.used_map = bitmap_create_in_buf (page_cnt,
+                                             free_start + bm_size,
+                                             bm_size);
+  user_owned_map = bitmap_create_in_buf (page_cnt,
+                                         free_start + 2 * bm_size,
+                                         bm_size);
+  bitmap_set_multiple (user_owned_map, 0, kernel_pages, false);
+  bitmap_set_multiple (user_owned_map, kernel_pages, user_pages, true);
+
+  init_pool (&kernel_pool, page_cnt, 0, kernel_pages, "kernel pool");
+  init_pool (&user_pool, page_cnt, kernel_pages, user_pages, "user pool");
+
+  kernel_pool.max_cnt = page_cnt;
+  kernel_pool.reserve_cnt = (kernel_reserve != SIZE_MAX
+                             ? kernel_reserve : kernel_pages / 4);
+  user_pool.max_cnt = (user_page_limit < page_cnt
+                       ? user_page_limit : page_cnt);
+  user_pool.reserve_cnt = 0;
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -69,20 +130,77 @@ palloc_init (size_t user_page_limit)
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
+{
+  return get_multiple (flags, page_cnt, __builtin_return_address (0));
+}
+
+/* Obtains a single free page and returns its kernel virtual
+   address.
+   If PAL_USER is set, the page is obtained from the user pool,
+   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
+   then the page is filled with zeros.  If no pages are
+   available, returns a null pointer, unless PAL_ASSERT is set in
+   FLAGS, in which case the kernel panics. */
+void *
+palloc_get_page (enum palloc_flags flags) 
+{
+  return get_multiple (flags, 1, __builtin_return_address (0));
+}
+
+/* Obtains PAGE_CNT contiguous free pages, which must be a power
+   of 2, whose physical address is a multiple of PAGE_CNT pages,
+   as needed to map them with one large page.  FLAGS are as for
+   palloc_get_multiple(), but this never borrows from the other
+   pool, since a loan is unlikely to be suitably aligned.  The
+   pages are accounted one by one, so that they may be freed one
+   at a time with palloc_free_page(). */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  const void *site = __builtin_return_address (0);
+  uint8_t *pages;
+  size_t page_idx, i;
+
+  ASSERT (page_cnt > 0 && (page_cnt & (page_cnt - 1)) == 0);
+
+  page_idx = take_aligned (pool, page_cnt);
+  if (page_idx == BITMAP_ERROR)
+    {
+      if (flags & PAL_ASSERT)
+        PANIC ("palloc_get_aligned: out of pages");
+      return NULL;
+    }
+
+  pages = pool_base + PGSIZE * page_idx;
+  if (flags & PAL_ZERO)
+    memset (pages, 0, PGSIZE * page_cnt);
+  for (i = 0; i < page_cnt; i++)
+    memstat_alloc (MEMSTAT_PAGES, pages + PGSIZE * i, 1, site);
+
+  return pages;
+}
+
+/* Implements palloc_get_multiple(), charging the pages to call
+   site SITE for memory accounting. */
+static void *
+get_multiple (enum palloc_flags flags, size_t page_cnt, const void *site)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  struct pool *other = flags & PAL_USER ? &kernel_pool : &user_pool;
   void *pages;
   size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  /* If the pool is exhausted, borrow from the other one. */
+  page_idx = take_pages (pool, page_cnt);
+  if (page_idx == BITMAP_ERROR && borrow_pages (pool, other, page_cnt))
+    page_idx = take_pages (pool, page_cnt);
 
   if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
+    pages = pool_base + PGSIZE * page_idx;
   else
     pages = NULL;
 
@@ -90,6 +208,7 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
     {
       if (flags & PAL_ZERO)
         memset (pages, 0, PGSIZE * page_cnt);
+      memstat_alloc (MEMSTAT_PAGES, pages, page_cnt, site);
     }
   else 
     {
@@ -100,19 +219,6 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   return pages;
 }
 
-/* Obtains a single free page and returns its kernel virtual
-   address.
-   If PAL_USER is set, the page is obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
-   then the page is filled with zeros.  If no pages are
-   available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
-void *
-palloc_get_page (enum palloc_flags flags) 
-{
-  return palloc_get_multiple (flags, 1);
-}
-
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) 
@@ -124,21 +230,60 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   if (pages == NULL || page_cnt == 0)
     return;
 
-  if (page_from_pool (&kernel_pool, pages))
-    pool = &kernel_pool;
-  else if (page_from_pool (&user_pool, pages))
-    pool = &user_pool;
-  else
-    NOT_REACHED ();
-
-  page_idx = pg_no (pages) - pg_no (pool->base);
+  pool = page_to_pool (pages, &page_idx);
+  memstat_free (MEMSTAT_PAGES, pages);
 
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  lock_acquire (&pool->lock);
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  pool->free_cnt += page_cnt;
+  lock_release (&pool->lock);
+}
+
+/* Tries to grow the block of PAGE_CNT pages starting at PAGES,
+   which must have been obtained from palloc_get_multiple(), to
+   NEW_PAGE_CNT pages without moving it.  Succeeds only if the
+   pages that follow the block are free and belong to the same
+   pool, in which case they are marked used (but not zeroed) and
+   true is returned.  Otherwise nothing changes and false is
+   returned. */
+bool
+palloc_extend_multiple (void *pages, size_t page_cnt, size_t new_page_cnt)
+{
+  struct pool *pool;
+  size_t page_idx;
+  size_t extra_cnt;
+  bool success = false;
+
+  ASSERT (pg_ofs (pages) == 0);
+  ASSERT (new_page_cnt >= page_cnt);
+  if (pages == NULL || page_cnt == 0)
+    return false;
+  if (new_page_cnt == page_cnt)
+    return true;
+
+  pool = page_to_pool (pages, &page_idx);
+  page_idx += page_cnt;
+  extra_cnt = new_page_cnt - page_cnt;
+
+  lock_acquire (&pool->lock);
+  if (page_idx + extra_cnt <= bitmap_size (pool->used_map)
+      && bitmap_none (pool->used_map, page_idx, extra_cnt))
+    {
+      bitmap_set_multiple (pool->used_map, page_idx, extra_cnt, true);
+      pool->free_cnt -= extra_cnt;
+      success = true;
+    }
+  lock_release (&pool->lock);
+
+  if (success)
+    memstat_resize (MEMSTAT_PAGES, pages, new_page_cnt);
+
+  return success;
 }
 
 /* Frees the page at PAGE. */
@@ -148,35 +293,145 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
-/* Initializes pool P as starting at START and ending at END,
+/* Returns the number of pages that palloc_get_page (PAL_USER)
+   could still hand out, counting those the user pool could
+   borrow from the kernel pool.  The value is a snapshot taken
+   without locking, good enough for deciding when to reclaim. */
+size_t
+palloc_user_free_cnt (void)
+{
+  size_t free_cnt = user_pool.free_cnt;
+  size_t room = user_pool.max_cnt - user_pool.owned_cnt;
+  size_t spare = (kernel_pool.free_cnt > kernel_pool.reserve_cnt
+                  ? kernel_pool.free_cnt - kernel_pool.reserve_cnt : 0);
+
+  return free_cnt + (spare < room ? spare : room);
+}
+
+/* Returns the most pages the user pool may ever own. */
+size_t
+palloc_user_max_cnt (void)
+{
+  return user_pool.max_cnt;
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns
+   the index of the first one, or BITMAP_ERROR if POOL has no
+   such run of free pages. */
+static size_t
+take_pages (struct pool *pool, size_t page_cnt)
+{
+  size_t page_idx;
+
+  lock_acquire (&pool->lock);
+  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  if (page_idx != BITMAP_ERROR)
+    pool->free_cnt -= page_cnt;
+  lock_release (&pool->lock);
+
+  return page_idx;
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL whose physical
+   address is a multiple of PAGE_CNT pages, and returns the index
+   of the first one, or BITMAP_ERROR if POOL has no such run of
+   free pages. */
+static size_t
+take_aligned (struct pool *pool, size_t page_cnt)
+{
+  size_t base_no = vtop (pool_base) / PGSIZE;
+  size_t page_idx = (page_cnt - base_no % page_cnt) % page_cnt;
+  size_t found = BITMAP_ERROR;
+
+  lock_acquire (&pool->lock);
+  if (pool->free_cnt >= page_cnt)
+    for (; page_idx + page_cnt <= bitmap_size (pool->used_map);
+         page_idx += page_cnt)
+      if (bitmap_none (pool->used_map, page_idx, page_cnt))
+        {
+          bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+          pool->free_cnt -= page_cnt;
+          found = page_idx;
+          break;
+        }
+  lock_release (&pool->lock);
+
+  return found;
+}
+
+/* Moves a run of at least PAGE_CNT contiguous free pages from
+   pool FROM to pool TO, and LOAN_PAGES pages if possible.
+   Respects FROM's reserve and TO's limit.  Returns true if
+   successful, false otherwise. */
+static bool
+borrow_pages (struct pool *to, struct pool *from, size_t page_cnt)
+{
+  size_t loan_cnt = page_cnt > LOAN_PAGES ? page_cnt : LOAN_PAGES;
+  size_t page_idx = BITMAP_ERROR;
+
+  /* Always lock the kernel pool first, to avoid deadlock. */
+  lock_acquire (&kernel_pool.lock);
+  lock_acquire (&user_pool.lock);
+
+  /* Try for a full loan first, then for just PAGE_CNT pages. */
+  for (;;)
+    {
+      if (to->owned_cnt + loan_cnt <= to->max_cnt
+          && from->free_cnt >= from->reserve_cnt + loan_cnt)
+        page_idx = bitmap_scan (from->used_map, 0, loan_cnt, false);
+      if (page_idx != BITMAP_ERROR || loan_cnt == page_cnt)
+        break;
+      loan_cnt = page_cnt;
+    }
+
+  if (page_idx != BITMAP_ERROR)
+    {
+      bitmap_set_multiple (from->used_map, page_idx, loan_cnt, true);
+      bitmap_set_multiple (to->used_map, page_idx, loan_cnt, false);
+      bitmap_set_multiple (user_owned_map, page_idx, loan_cnt,
+                           to == &user_pool);
+      from->owned_cnt -= loan_cnt;
+      from->free_cnt -= loan_cnt;
+      to->owned_cnt += loan_cnt;
+      to->free_cnt += loan_cnt;
+    }
+
+  lock_release (&user_pool.lock);
+  lock_release (&kernel_pool.lock);
+
+  return page_idx != BITMAP_ERROR;
+}
+
+/* Initializes pool P as owning the CNT pages starting at page
+   index FIRST out of the PAGE_CNT pages that the pools manage,
    naming it NAME for debugging purposes. */
 static void
-init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
+init_pool (struct pool *p, size_t page_cnt, size_t first, size_t cnt,
+           const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
-
-  printf ("%zu pages available in %s.\n", page_cnt, name);
+  printf ("%zu pages available in %s.\n", cnt, name);
 
   /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  bitmap_set_all (p->used_map, true);
+  bitmap_set_multiple (p->used_map, first, cnt, false);
+  p->owned_cnt = p->free_cnt = cnt;
+  ASSERT (first + cnt <= page_cnt);
 }
 
-/* Returns true if PAGE was allocated from POOL,
-   false otherwise. */
-static bool
-page_from_pool (const struct pool *pool, void *page) 
+/* Returns the pool that owns PAGE, and stores PAGE's index in
+   the pools' bitmaps into *PAGE_IDX. */
+static struct pool *
+page_to_pool (void *page, size_t *page_idx) 
 {
   size_t page_no = pg_no (page);
-  size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t start_page = pg_no (pool_base);
+  size_t end_page = start_page + bitmap_size (user_owned_map);
+
+  if (page_no < start_page || page_no >= end_page)
+    NOT_REACHED ();
 
-  return page_no >= start_page && page_no < end_page;
+  *page_idx = page_no - start_page;
+  return (bitmap_test (user_owned_map, *page_idx)
+          ? &user_pool : &kernel_pool);
 }
@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -11,10 +12,14 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
-void palloc_init (size_t user_page_limit);
+void palloc_init (size_t user_page_limit, size_t kernel_reserve);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
+void *palloc_get_aligned (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_extend_multiple (void *, size_t page_cnt, size_t new_page_cnt);
+size_t palloc_user_free_cnt (void);
+size_t palloc_user_max_cnt (void);
 
 #endif /* threads/palloc.h */
@@ -225,6 +225,9 @@ thread_create (const char *name, int priority,
   /* set parent's thread descriptor */
   t->parent = thread_current();
 
+  /* inherit resident-set limit */
+  t->rss_limit = thread_current()->rss_limit;
+
   /* push back on child list */
   list_push_back ( &thread_current()->child_list, &t->child_elem );
 
@@ -114,6 +114,12 @@ struct thread
     int nice;                           /* set nice value for mlfqs */
     int recent_cpu;                     /* set recently-used cpu ticks for mlfqs */
 
+    /* Memory accounting, see threads/memstat.c. */
+    size_t mem_pages;                   /* palloc pages outstanding */
+    size_t mem_pages_peak;              /* high-water mark of mem_pages */
+    size_t mem_bytes;                   /* malloc bytes outstanding */
+    size_t mem_bytes_peak;              /* high-water mark of mem_bytes */
+
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
@@ -145,6 +151,18 @@ struct thread
 
     /* Assignment 11 : virtual memory */
     struct hash vm;                     /* hash table for vm_entry */
+    struct vm_area **areas;             /* regions, sorted by address */
+    size_t area_cnt;                    /* number of regions */
+    size_t area_max;                    /* room in areas */
+    struct vm_area *area_cache;         /* region found last */
+
+    /* Resident set, see vm/page.c. */
+    size_t rss;                         /* resident pages mapped */
+    size_t rss_peak;                    /* high-water mark of rss */
+    size_t rss_limit;                   /* evict own pages above, 0 : none */
+    size_t wss;                         /* pages used in last sample */
+    size_t ws_cnt;                      /* pages used so far this sample */
+    unsigned fault_cnt;                 /* page faults taken */
 
     /* Assignment 12 : mmap */
     struct list mmap_list;              /* list of mmap_file */
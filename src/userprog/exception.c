@@ -147,6 +147,7 @@ page_fault (struct intr_frame *f)
 
   /* Count page faults. */
   page_fault_cnt++;
+  thread_current ()->fault_cnt++;
 
   /* Determine cause. */
   not_present = (f->error_code & PF_P) == 0;
@@ -176,6 +177,9 @@ page_fault (struct intr_frame *f)
         sys_exit( -1 );
       }
     }
+    /* reading untouched zero page : share zero frame. */
+    else if( vme->is_zero && write == false && map_zero_page( vme ) )
+      ;
     /* if not handled correctly, exit. */
     else if( handle_mm_fault( vme ) == false )
     {
@@ -185,8 +189,16 @@ page_fault (struct intr_frame *f)
   }
   else
   {
-//    printf("access violation : %p\n", fault_addr);
-    sys_exit( -1 );
+    /* writing shared zero frame, or page shared since fork :
+       give page its own frame. */
+    vme = find_vme( fault_addr );
+    if( write == false || vme == NULL
+        || ( vme->zero_mapped == false && vme->is_loaded == false )
+        || vme->writable == false || handle_mm_fault( vme ) == false )
+    {
+//      printf("access violation : %p\n", fault_addr);
+      sys_exit( -1 );
+    }
   }
 }
 
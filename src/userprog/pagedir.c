@@ -3,11 +3,23 @@
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
+static uint32_t *lookup_large (uint32_t *, const void *);
+static void split_large_page (uint32_t *, uint32_t *pde);
+static void put_spare_pt (uint32_t *);
+static uint32_t *take_spare_pt (void);
+
+/* Page tables set aside for splitting 4 MB pages, one for each
+   4 MB page mapped in any page directory, linked through their
+   first word.  Splitting happens on the eviction and copy-on-write
+   paths, when the kernel pool may be empty, so it must not
+   allocate. */
+static uint32_t *spare_pts;
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -34,16 +46,22 @@ pagedir_destroy (uint32_t *pd)
 
   ASSERT (pd != init_page_dir);
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P) 
-      {
-        uint32_t *pt = pde_get_pt (*pde);
-        uint32_t *pte;
+    {
+      /* 4 MB pages are removed with pagedir_clear_large_page(),
+         or split when their pages are freed one by one. */
+      ASSERT ((*pde & PTE_PS) == 0);
+
+      if (*pde & PTE_P) 
+        {
+          uint32_t *pt = pde_get_pt (*pde);
+          uint32_t *pte;
         
-        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
-          if (*pte & PTE_P) 
-            palloc_free_page (pte_get_page (*pte));
-        palloc_free_page (pt);
-      }
+          for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+            if (*pte & PTE_P) 
+              palloc_free_page (pte_get_page (*pte));
+          palloc_free_page (pt);
+        }
+    }
   palloc_free_page (pd);
 }
 
@@ -52,7 +70,9 @@ pagedir_destroy (uint32_t *pd)
    If PD does not have a page table for VADDR, behavior depends
    on CREATE.  If CREATE is true, then a new page table is
    created and a pointer into it is returned.  Otherwise, a null
-   pointer is returned. */
+   pointer is returned.
+   If VADDR lies in a 4 MB page, that page is first split into
+   4 kB pages, since the caller is about to change one of them. */
 static uint32_t *
 lookup_page (uint32_t *pd, const void *vaddr, bool create)
 {
@@ -79,12 +99,73 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
       else
         return NULL;
     }
+  else if (*pde & PTE_PS)
+    split_large_page (pd, pde);
 
   /* Return the page table entry. */
   pt = pde_get_pt (*pde);
   return &pt[pt_no (vaddr)];
 }
 
+/* Returns the PDE for user virtual address VADDR in PD if it
+   maps a 4 MB page, otherwise a null pointer. */
+static uint32_t *
+lookup_large (uint32_t *pd, const void *vaddr)
+{
+  uint32_t *pde = pd + pd_no (vaddr);
+
+  return (*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS) ? pde : NULL;
+}
+
+/* Replaces the 4 MB page that *PDE in PD maps by the page table
+   set aside for it, mapping the same frames with 4 kB pages.  Each of them
+   inherits the large page's writable, accessed and dirty bits. */
+static void
+split_large_page (uint32_t *pd, uint32_t *pde)
+{
+  enum intr_level old_level;
+  uint8_t *page;
+  uint32_t *pt;
+  uint32_t flags;
+  size_t i;
+
+  /* The CPU may set the accessed and dirty bits until the PDE is
+     replaced. */
+  old_level = intr_disable ();
+  pt = take_spare_pt ();
+  page = pde_get_large (*pde);
+  flags = *pde & (PTE_W | PTE_A | PTE_D);
+  for (i = 0; i < PGSIZE / sizeof *pt; i++)
+    pt[i] = pte_create_user (page + i * PGSIZE, false) | flags;
+  *pde = pde_create (pt);
+  invalidate_pagedir (pd);
+  intr_set_level (old_level);
+}
+
+/* Adds PT to the spare page tables. */
+static void
+put_spare_pt (uint32_t *pt)
+{
+  enum intr_level old_level = intr_disable ();
+  *(uint32_t **) pt = spare_pts;
+  spare_pts = pt;
+  intr_set_level (old_level);
+}
+
+/* Removes a page table from the spare page tables and returns
+   it.  There is always one for each 4 MB page still mapped. */
+static uint32_t *
+take_spare_pt (void)
+{
+  enum intr_level old_level = intr_disable ();
+  uint32_t *pt = spare_pts;
+
+  ASSERT (pt != NULL);
+  spare_pts = *(uint32_t **) pt;
+  intr_set_level (old_level);
+  return pt;
+}
+
 /* Adds a mapping in page directory PD from user virtual page
    UPAGE to the physical frame identified by kernel virtual
    address KPAGE.
@@ -118,6 +199,72 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
     return false;
 }
 
+/* Maps the 4 MB of user virtual memory starting at UPAGE in PD
+   to the physical frames starting at kernel virtual address
+   KPAGE with a single 4 MB page.  Both must be 4 MB aligned, and
+   KPAGE should come from palloc_get_aligned().  No page in the
+   range may be mapped.  If WRITABLE is true, the pages are
+   read/write; otherwise they are read-only.  Later changes to
+   any one page split the mapping back into 4 kB pages, using a
+   page table set aside now.
+   Returns false if the CPU has 4 MB pages turned off, or if
+   memory for that page table cannot be allocated. */
+bool
+pagedir_set_large_page (uint32_t *pd, void *upage, void *kpage,
+                        bool writable)
+{
+  uint32_t *pde;
+
+  ASSERT (((uintptr_t) upage & (PTSPAN - 1)) == 0);
+  ASSERT (((uintptr_t) kpage & (PTSPAN - 1)) == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (vtop (kpage) >> PTSHIFT < init_ram_pages);
+  ASSERT (pd != init_page_dir);
+
+  if (!init_pse)
+    return false;
+
+  /* Set aside the page table left by earlier mappings, or a new
+     one, for splitting the page later. */
+  pde = pd + pd_no (upage);
+  if (*pde != 0)
+    {
+      uint32_t *pt = pde_get_pt (*pde);
+      size_t i;
+
+      for (i = 0; i < PGSIZE / sizeof *pt; i++)
+        ASSERT ((pt[i] & PTE_P) == 0);
+      put_spare_pt (pt);
+    }
+  else
+    {
+      uint32_t *pt = palloc_get_page (0);
+      if (pt == NULL)
+        return false;
+      put_spare_pt (pt);
+    }
+
+  *pde = pde_create_large_user (kpage, writable);
+  invalidate_pagedir (pd);
+  return true;
+}
+
+/* Removes the 4 MB page mapped at UPAGE in PD, which must not
+   have been split, and frees the page table set aside for it.
+   Its frames are left to the caller. */
+void
+pagedir_clear_large_page (uint32_t *pd, void *upage)
+{
+  uint32_t *pde = lookup_large (pd, upage);
+
+  ASSERT (((uintptr_t) upage & (PTSPAN - 1)) == 0);
+  ASSERT (pde != NULL);
+
+  *pde = 0;
+  invalidate_pagedir (pd);
+  palloc_free_page (take_spare_pt ());
+}
+
 /* Looks up the physical address that corresponds to user virtual
    address UADDR in PD.  Returns the kernel virtual address
    corresponding to that physical address, or a null pointer if
@@ -125,9 +272,14 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
 void *
 pagedir_get_page (uint32_t *pd, const void *uaddr) 
 {
-  uint32_t *pte;
+  uint32_t *pte, *pde;
 
   ASSERT (is_user_vaddr (uaddr));
+
+  pde = lookup_large (pd, uaddr);
+  if (pde != NULL)
+    return (uint8_t *) pde_get_large (*pde)
+           + ((uintptr_t) uaddr & (PTSPAN - 1));
   
   pte = lookup_page (pd, uaddr, false);
   if (pte != NULL && (*pte & PTE_P) != 0)
@@ -163,7 +315,10 @@ pagedir_clear_page (uint32_t *pd, void *upage)
 bool
 pagedir_is_dirty (uint32_t *pd, const void *vpage) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pte = lookup_large (pd, vpage);
+
+  if (pte == NULL)
+    pte = lookup_page (pd, vpage, false);
   return pte != NULL && (*pte & PTE_D) != 0;
 }
 
@@ -185,6 +340,22 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
     }
 }
 
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PD.  Has no effect if VPAGE is not mapped. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable)
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL && (*pte & PTE_P) != 0)
+    {
+      if (writable)
+        *pte |= PTE_W;
+      else
+        *pte &= ~(uint32_t) PTE_W;
+      invalidate_pagedir (pd);
+    }
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD has been
    accessed recently, that is, between the time the PTE was
    installed and the last time it was cleared.  Returns false if
@@ -192,16 +363,24 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
 bool
 pagedir_is_accessed (uint32_t *pd, const void *vpage) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pte = lookup_large (pd, vpage);
+
+  if (pte == NULL)
+    pte = lookup_page (pd, vpage, false);
   return pte != NULL && (*pte & PTE_A) != 0;
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+   VPAGE in PD.  All pages of a 4 MB page share one accessed bit,
+   so clearing it for one of them splits the 4 MB page first;
+   otherwise the others would look unused as well. */
 void
 pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pte = accessed ? lookup_large (pd, vpage) : NULL;
+
+  if (pte == NULL)
+    pte = lookup_page (pd, vpage, false);
   if (pte != NULL) 
     {
       if (accessed)
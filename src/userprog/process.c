@@ -23,6 +23,9 @@
 #include "vm/swap.h"
 
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
+static bool fork_files (struct thread *parent);
+static bool fork_vm (struct thread *parent);
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 char** argument_tokenizer (char* input_string, int* argc_receiver);
 bool argument_stack (char **parse, int count, void **esp);
@@ -34,8 +37,18 @@ struct cmdline
   int argc;
 };
 
+/* what the child of fork() copies from. */
+struct fork_info
+{
+  struct thread *parent;
+  struct intr_frame if_;      /* parent's frame at system call */
+};
+
 extern struct lock filesys_lock; /* lock for file I/O */
 
+/* Assignment 14 : most the stack may grow, from "-stack=KB". */
+size_t stack_limit = 8 * 1024 * 1024;
+
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
    before process_execute() returns.  Returns the new process's
@@ -157,6 +170,194 @@ start_process (void *aux)
   NOT_REACHED ();
 }
 
+/* Starts a new thread running a copy of the current process,
+   which returns from the system call at F with 0.  Memory is
+   shared copy-on-write, so this costs one vm_entry and one page
+   table entry per mapped page, not a copy of every page.
+   Returns the new thread id, or TID_ERROR. */
+tid_t
+process_fork (struct intr_frame *f)
+{
+  struct fork_info *info;
+  tid_t tid;
+
+  /* The child copies vm_entries, which superpages do not have
+     until they are split. */
+  if (!split_superpages ())
+    return TID_ERROR;
+
+  info = malloc (sizeof *info);
+  if (info == NULL)
+    return TID_ERROR;
+  info->parent = thread_current ();
+  info->if_ = *f;
+
+  tid = thread_create (thread_current ()->name, PRI_DEFAULT,
+                       start_fork, info);
+  if (tid == TID_ERROR)
+    free (info);
+  return tid;
+}
+
+/* A thread function that copies the parent process and starts
+   running it.  The parent is blocked on sema_load meanwhile. */
+static void
+start_fork (void *aux)
+{
+  struct fork_info *info = aux;
+  struct thread *cur = thread_current ();
+  struct intr_frame if_;
+  bool success = false;
+
+  vm_init (&cur->vm);
+  list_init (&cur->mmap_list);
+  cur->mmap_id = info->parent->mmap_id;
+
+  /* child sees fork() return 0. */
+  if_ = info->if_;
+  if_.eax = 0;
+
+  cur->pagedir = pagedir_create ();
+  if (cur->pagedir != NULL)
+    {
+      process_activate ();
+      success = fork_files (info->parent) && fork_vm (info->parent);
+    }
+  free (info);
+
+  cur->loaded = success;
+
+  /* unblock parent thread */
+  sema_up (&cur->sema_load);
+
+  if (!success)
+    thread_exit ();
+
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Opens the parent's executable and files again for the child.
+   Each file gets its own position, starting where the parent's
+   is. */
+static bool
+fork_files (struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  bool success = true;
+  int fd;
+
+  lock_acquire (&filesys_lock);
+
+  if (parent->current_file != NULL)
+    {
+      cur->current_file = file_reopen (parent->current_file);
+      if (cur->current_file != NULL)
+        file_deny_write (cur->current_file);
+      else
+        success = false;
+    }
+
+  for (fd = 2; success && fd < parent->num_fd; fd++)
+    {
+      struct file *file = parent->fd_table[fd];
+
+      if (file != NULL)
+        {
+          cur->fd_table[fd] = file_reopen (file);
+          if (cur->fd_table[fd] == NULL)
+            success = false;
+          else
+            file_seek (cur->fd_table[fd], file_tell (file));
+        }
+      cur->num_fd = fd + 1;
+    }
+
+  lock_release (&filesys_lock);
+
+  return success;
+}
+
+/* Copies the parent's regions, vm table and memory-mapped files.
+   Must be called after fork_files(). */
+static bool
+fork_vm (struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  struct hash_iterator i;
+  struct list_elem *e;
+  size_t n;
+
+  /* regions : same range, child's own files. */
+  for (n = 0; n < parent->area_cnt; n++)
+    {
+      struct vm_area *area = malloc (sizeof *area);
+
+      if (area == NULL)
+        return false;
+      *area = *parent->areas[n];
+      if (area->file == parent->current_file)
+        area->file = cur->current_file;
+      if (!insert_area (area))
+        {
+          free (area);
+          return false;
+        }
+    }
+
+  /* memory-mapped files : reopened, for their regions. */
+  for (e = list_begin (&parent->mmap_list); e != list_end (&parent->mmap_list);
+       e = list_next (e))
+    {
+      struct mmap_file *pmap = list_entry (e, struct mmap_file, elem);
+      struct mmap_file *mmap_file = malloc (sizeof *mmap_file);
+
+      if (mmap_file == NULL)
+        return false;
+      memset (mmap_file, 0, sizeof *mmap_file);
+      mmap_file->map_id = pmap->map_id;
+      list_push_back (&cur->mmap_list, &mmap_file->elem);
+
+      lock_acquire (&filesys_lock);
+      mmap_file->file = file_reopen (pmap->file);
+      lock_release (&filesys_lock);
+      if (mmap_file->file == NULL)
+        return false;
+
+      if (pmap->area != NULL)
+        {
+          mmap_file->area = find_area (pmap->area->start);
+          mmap_file->area->file = mmap_file->file;
+        }
+    }
+
+  /* pages touched so far : shared until written. */
+  hash_first (&i, &parent->vm);
+  while (hash_next (&i))
+    {
+      struct vm_entry *pvme = hash_entry (hash_cur (&i), struct vm_entry, elem);
+      struct vm_entry *vme = malloc (sizeof *vme);
+
+      if (vme == NULL || !fork_vme (vme, pvme))
+        {
+          free (vme);
+          return false;
+        }
+
+      if (pvme->area != NULL)
+        {
+          vme->area = find_area (vme->vaddr);
+          vme->file = vme->area->file;
+          list_push_back (&vme->area->vme_list, &vme->area_elem);
+        }
+      else if (vme->file == parent->current_file)
+        vme->file = cur->current_file;
+      insert_vme (&cur->vm, vme);
+    }
+
+  return true;
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -206,9 +407,6 @@ process_exit (void)
     file_close( cur->fd_table[iFile] );
   }
 
-  /* Assignment 5 : close current executable */
-  file_close( thread_current()->current_file );
-
   /* deallocate fd_table */
   palloc_free_page( cur->fd_table );
 
@@ -226,6 +424,10 @@ process_exit (void)
   /* Assignment 11 : destroy vm table */
   vm_destroy( &cur->vm );
 
+  /* Assignment 5 : close current executable
+     after its pages : text cache holds them by its inode. */
+  file_close( thread_current()->current_file );
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -520,50 +722,46 @@ static bool
 load_segment (struct file *file, off_t ofs, uint8_t *upage,
               uint32_t read_bytes, uint32_t zero_bytes, bool writable) 
 {
-  struct vm_entry *vme;
+  struct vm_area *area;
 
   ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  file_seek (file, ofs);
-  while (read_bytes > 0 || zero_bytes > 0) 
+  /* Assignment 11 : pages already loaded by previous segment
+     stay as they are. */
+  while ((read_bytes > 0 || zero_bytes > 0) && find_area (upage) != NULL)
     {
-      /* Calculate how to fill this page.
-         We will read PAGE_READ_BYTES bytes from FILE
-         and zero the final PAGE_ZERO_BYTES bytes. */
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-      /* Assignment 11 : create vm_entry */
-      vme = (struct vm_entry*) malloc (sizeof(struct vm_entry));
-      if( vme == NULL )
-          return false;
-
-      /* set vme's values. */
-      memset( vme, 0, sizeof(struct vm_entry) );
-      vme->type = VM_BIN;
-      vme->vaddr = upage;
-      vme->writable = writable;
-      vme->file = file;
-      vme->offset = ofs;
-      vme->read_bytes = page_read_bytes;
-      vme->zero_bytes = page_zero_bytes;
-
-      /* insert into vm table. if failed, free vme. */
-      if( insert_vme( &thread_current()->vm, vme ) == false )
-      {
-        free( vme );
-      }
-
-      /* set offset. */
       ofs += page_read_bytes;
-
-      /* Advance. */
       read_bytes -= page_read_bytes;
       zero_bytes -= page_zero_bytes;
       upage += PGSIZE;
     }
+  if (read_bytes == 0 && zero_bytes == 0)
+    return true;
+
+  /* one region for the segment : pages get vm_entry when touched. */
+  area = (struct vm_area*) malloc (sizeof(struct vm_area));
+  if( area == NULL )
+    return false;
+
+  memset( area, 0, sizeof(struct vm_area) );
+  area->type = VM_BIN;
+  area->start = upage;
+  area->end = upage + read_bytes + zero_bytes;
+  area->writable = writable;
+  area->file = file;
+  area->offset = ofs;
+  area->read_bytes = read_bytes;
+
+  if( insert_area( area ) == false )
+  {
+    free( area );
+    return false;
+  }
   return true;
 }
 
@@ -572,46 +770,34 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 static bool
 setup_stack (void **esp) 
 {
-  struct page* kpage;
-  bool success = false;
+  struct vm_area *area;
   struct vm_entry *vme;
 
-  kpage = alloc_page( PAL_USER | PAL_ZERO );
-  if (kpage != NULL) 
-    {
-      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage->kaddr, true);
-      if (success)
-        *esp = PHYS_BASE;
-      else
-      {
-        free_page( kpage );
-        return false;
-      }
-  
-      /* Assignment 11 : stack page to vm_entry */
-      vme = (struct vm_entry*) malloc (sizeof(struct vm_entry));
-      if( vme == NULL )
-        return false;
+  /* Assignment 14 : stack is a region growing down from PHYS_BASE,
+     one page to start with. */
+  area = (struct vm_area*) malloc (sizeof(struct vm_area));
+  if( area == NULL )
+    return false;
 
-      /* set vme's values. */
-      memset( vme, 0, sizeof(struct vm_entry) );
-      vme->type = VM_ANON;
-      vme->vaddr = ((uint8_t*)PHYS_BASE) - PGSIZE;
-      vme->writable = true;
-      vme->is_loaded = true;
+  memset( area, 0, sizeof(struct vm_area) );
+  area->type = VM_ANON;
+  area->start = (uint8_t*)PHYS_BASE - PGSIZE;
+  area->end = PHYS_BASE;
+  area->writable = true;
 
-      /* insert into vm table. if failed, free vme. */
-      if( insert_vme( &thread_current()->vm, vme ) == false )
-      {
-        free( vme );
-      }
+  if( insert_area( area ) == false )
+  {
+    free( area );
+    return false;
+  }
 
-      /* set page's vme, lru_elem. */
-      kpage->vme = vme;
-      add_page_to_list( kpage );
-    }
+  /* top page : zeroed and mapped now. */
+  vme = find_vme( area->start );
+  if( vme == NULL || handle_mm_fault( vme ) == false )
+    return false;
 
-  return success;
+  *esp = PHYS_BASE;
+  return true;
 }
 
 /* Adds a mapping from user virtual address UPAGE to kernel
@@ -669,11 +855,11 @@ argument_tokenizer (char* input_string, int* argc_receiver)
        token != NULL;
        token = strtok_r( NULL, " ", &savePtr ) )
   {
-    arguments[iArg] = (char*)malloc(sizeof(char) * strlen(token));
+    arguments[iArg] = (char*)malloc(sizeof(char) * (strlen(token)+1));
     if( arguments[iArg] == NULL )
     {
       for( i=iArg-1; i>-1; i-- )
-        free( arguments[iArg] );
+        free( arguments[i] );
       free( arguments );
       return NULL;
     }
@@ -837,11 +1023,37 @@ handle_mm_fault( struct vm_entry *vme )
 {
   struct page* kpage;
 
-  /* allocate memory. */
-  kpage = alloc_page( PAL_USER );
+  /* still being written out by evictor : wait for it.
+     swap was full and page stayed, or it is shared since
+     fork : copy it if shared, nothing else to do. */
+  if( wait_for_eviction( vme ) )
+    return break_cow( vme );
+
+  /* already read ahead from swap : just map it. */
+  if( map_readahead_page( vme ) )
+    return true;
+
+  /* code another process has loaded : map the same frame. */
+  if( map_shared_page( vme ) )
+    return true;
+
+  /* first write in an untouched 4 MB block : map all of it. */
+  if( vme->is_zero && map_superpage( vme ) )
+    return true;
 
+  /* first write to shared zero frame : replace it. */
+  unmap_zero_page( vme );
+
+  /* allocate memory. out of memory and swap : fail. */
+  kpage = alloc_page( vme->is_zero ? PAL_USER | PAL_ZERO : PAL_USER );
+  if( kpage == NULL )
+    return false;
+
+  /* zero page : PAL_ZERO did all the loading. */
+  if( vme->is_zero )
+    vme->is_zero = false;
   /* load page according to type. */
-  switch( vme->type )
+  else switch( vme->type )
   {
     case VM_BIN:
     case VM_FILE:
@@ -854,13 +1066,9 @@ handle_mm_fault( struct vm_entry *vme )
       break;
 
     case VM_ANON:
-      /* swap in. */
+      /* swap in, and neighbours swapped out with it. */
       swap_in( vme->swap_slot, kpage->kaddr );
-      break;
-
-    case STACK_HEURISTIC:
-      /* change type into 'stack'. */
-      vme->type = VM_ANON;
+      swap_readahead( vme );
       break;
 
     default:
@@ -880,6 +1088,10 @@ handle_mm_fault( struct vm_entry *vme )
   kpage->vme = vme;
   add_page_to_list( kpage );
 
+  /* file-backed : neighbours will likely fault next. */
+  if( vme->type == VM_BIN || vme->type == VM_FILE )
+    fault_around( vme );
+
   return true;
 }
 
@@ -899,8 +1111,8 @@ bool verify_stack( void* sp, void* fault_addr )
       return false;
   }
 
-  /* if over 8MB, return false. */
-  if( (unsigned)sp < 0xBF800000 )
+  /* if over stack limit, return false. */
+  if( (unsigned)PHYS_BASE - (unsigned)fault_addr > stack_limit )
     return false;
 
   return true;
@@ -908,42 +1120,19 @@ bool verify_stack( void* sp, void* fault_addr )
 
 /*
  * Assignment 14 : expand stack
+ * only moves bottom of stack region : pages in between get
+ * vm_entry and frame when they are touched.
  */
 bool expand_stack( void* vaddr )
 {
+  struct vm_area* stack = find_area( (uint8_t*)PHYS_BASE - PGSIZE );
   struct vm_entry* vme;
-  void* round_down_vaddr = pg_round_down( vaddr );
-
-  while( (unsigned)round_down_vaddr < 0xC0000000 )
-  {
-    /* create new vm_entry. */
-    vme = (struct vm_entry*) malloc (sizeof(struct vm_entry));
 
-    /* initialize vm_entry. */
-    memset( vme, 0, sizeof(struct vm_entry) );
-    vme->type = STACK_HEURISTIC;
-    vme->vaddr = round_down_vaddr;
-    vme->writable = true;
-
-    /* call handle_mm_fault : install page. */
-    if ( insert_vme( &thread_current()->vm, vme ) == true )
-    {
-      if( handle_mm_fault( vme ) == false )
-      {
-        free( vme );
-        return false;
-      }
-    }
-    else
-    {
-      break;
-    }
-
-    round_down_vaddr += PGSIZE;
-  }
+  if( stack == NULL || stack->type != VM_ANON
+      || extend_area( stack, pg_round_down( vaddr ) ) == false )
+    return false;
 
-  return true;
+  /* faulting page itself. */
+  vme = find_vme( vaddr );
+  return vme != NULL && handle_mm_fault( vme );
 }
-
-
-
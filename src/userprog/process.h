@@ -2,9 +2,11 @@
 #define USERPROG_PROCESS_H
 
 #include "threads/thread.h"
+#include "threads/interrupt.h"
 #include "vm/page.h"
 
 tid_t process_execute (const char *file_name);
+tid_t process_fork (struct intr_frame *f);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
@@ -17,6 +19,7 @@ void process_close_file (int fd);
 bool handle_mm_fault( struct vm_entry *vme );
 
 /* Assignment 14 : expand stack */
+extern size_t stack_limit;
 bool verify_stack( void* sp, void* fault_addr );
 bool expand_stack( void* vaddr );
 
@@ -1,6 +1,7 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
 #include <string.h>
+#include <round.h>
 #include <syscall-nr.h>
 #include <devices/input.h>
 #include "threads/interrupt.h"
@@ -30,6 +31,7 @@ static void exit(int status);
 static bool create(const char *file, unsigned initial_size);
 static bool remove(const char *file);
 static tid_t exec(const char *cmd_line);
+static tid_t do_fork(struct intr_frame *f);
 static int wait(tid_t tid);
 static int open(const char *file);
 static int filesize(int fd);
@@ -40,6 +42,15 @@ static unsigned tell(int fd);
 static void close(int fd);
 static int mmap(int fd, void* addr);
 static void munmap(int map_id);
+static int madvise(void *addr, unsigned length, int advice);
+static int msync(int map_id, int flags);
+static int mmap_range(int fd, void* addr, unsigned offset, unsigned length,
+                      int prot);
+static int do_mmap(struct file *file, void *addr, off_t offset,
+                   size_t length, bool writable);
+static int munmap_range(void *addr, unsigned length);
+static int vmstat(tid_t pid, struct vmstat *st);
+static unsigned rss_limit(unsigned pages);
 
 /*
  * in case that the kernel needs to call exit.
@@ -61,7 +72,7 @@ static void
 syscall_handler (struct intr_frame *f UNUSED) 
 {
   int syscall_index;
-  int arguments[3];
+  int arguments[5];
 
   //check esp, if in user area, get syscall index
   check_address(f->esp, f->esp);
@@ -118,6 +129,52 @@ syscall_handler (struct intr_frame *f UNUSED)
       f->eax = exec( *((const char**)(f->esp) + 1) );
       break;
 
+    case SYS_FORK:
+      f->eax = do_fork( f );
+      break;
+
+    case SYS_MADVISE:
+      // argument num 3 : void*, unsigned, int
+      get_argument(f->esp, arguments, 3);
+      f->eax = madvise( (void*)arguments[0], (unsigned)arguments[1],
+                        arguments[2] );
+      break;
+
+    case SYS_MSYNC:
+      // argument num 2 : int, int
+      get_argument(f->esp, arguments, 2);
+      f->eax = msync( arguments[0], arguments[1] );
+      break;
+
+    case SYS_MMAP_RANGE:
+      // argument num 5 : int, void*, unsigned, unsigned, int
+      get_argument(f->esp, arguments, 5);
+      f->eax = mmap_range( arguments[0], (void*)arguments[1],
+                           (unsigned)arguments[2], (unsigned)arguments[3],
+                           arguments[4] );
+      break;
+
+    case SYS_MUNMAP_RANGE:
+      // argument num 2 : void*, unsigned
+      get_argument(f->esp, arguments, 2);
+      f->eax = munmap_range( (void*)arguments[0], (unsigned)arguments[1] );
+      break;
+
+    case SYS_VMSTAT:
+      // argument num 2 : int, struct vmstat*
+      get_argument(f->esp, arguments, 2);
+      check_valid_buffer( (void*)arguments[1], sizeof(struct vmstat),
+                          f->esp, true );
+      f->eax = vmstat( arguments[0], (struct vmstat*)arguments[1] );
+      vm_unpin( (void*)arguments[1], sizeof(struct vmstat) );
+      break;
+
+    case SYS_RSS_LIMIT:
+      // argument num 1 : unsigned
+      get_argument(f->esp, arguments, 1);
+      f->eax = rss_limit( (unsigned)arguments[0] );
+      break;
+
     case SYS_WAIT:
       // argument num 1 : int
       get_argument(f->esp, arguments, 1);
@@ -152,6 +209,7 @@ syscall_handler (struct intr_frame *f UNUSED)
       check_valid_buffer( (void*)arguments[1], (unsigned)arguments[2], f->esp, true );
 
       f->eax = read( arguments[0], (void *)arguments[1], (unsigned)arguments[2] );
+      vm_unpin( (void*)arguments[1], (unsigned)arguments[2] );
       break;
 
     case SYS_WRITE:
@@ -160,10 +218,11 @@ syscall_handler (struct intr_frame *f UNUSED)
 
       // verify const char*
       // check_address((void *)arguments[1], f->esp);
-      /* Assignment 11 : check string */
-      check_valid_string( (const void*)arguments[1], f->esp );
+      /* Assignment 11 : check buffer */
+      check_valid_buffer( (void*)arguments[1], (unsigned)arguments[2], f->esp, false );
 
       f->eax = write( arguments[0], (void *)arguments[1], (unsigned)arguments[2] );
+      vm_unpin( (void*)arguments[1], (unsigned)arguments[2] );
       break;
 
     case SYS_SEEK:
@@ -234,7 +293,8 @@ get_argument (void *esp, int *arg, int count)
 }
 
 /*
- * Assignment 11 : check valid buffer
+ * Assignment 11 : check valid buffer, then load and pin it.
+ * caller unpins it with vm_unpin() after I/O.
  */
 void
 check_valid_buffer( void *buffer, unsigned size, void *esp, bool to_write )
@@ -269,6 +329,12 @@ check_valid_buffer( void *buffer, unsigned size, void *esp, bool to_write )
     /* set prev page. */
     prev_page = curr_page;
   }
+
+  /* no page faults inside file system from now on. */
+  if( vm_pin( buffer, size, to_write ) == false )
+  {
+    exit( -1 );
+  }
 }
 
 /*
@@ -383,6 +449,35 @@ exec (const char *cmd_line)
   return new_tid;
 }
 
+/*
+ * System Call
+ * do_fork : duplicate this process, child returns 0
+ */
+static tid_t
+do_fork (struct intr_frame *f)
+{
+  tid_t new_tid;
+  struct thread *child;
+
+  new_tid = process_fork( f );
+  if( new_tid == TID_ERROR )
+    return -1;
+
+  // get child descriptor
+  child = get_child_process( new_tid );
+  if( child == NULL )
+    return -1;
+
+  // block this thread until the child copied this process
+  sema_down( &child->sema_load );
+
+  // if copy failed, return -1
+  if( child->loaded == false )
+    return -1;
+
+  return new_tid;
+}
+
 /*
  * System Call
  * wait : return process_wait
@@ -609,14 +704,28 @@ static int
 mmap (int fd, void* addr)
 {
   struct file *file;
-  struct mmap_file *mmap_file;
-  struct vm_entry *vme;
-  int length, offset=0;
 
-  /* check address */
-  if( (unsigned)addr < 0x8048000 
-      || (unsigned)addr >= 0xc0000000 
-      || pg_ofs( addr ) != 0)
+  /* get file descriptor */
+  file = process_get_file( fd );
+  if( file == NULL )
+    return -1;
+
+  /* whole file, writable. */
+  return do_mmap( file, addr, 0, file_length( file ), true );
+}
+
+/*
+ * System Call
+ * mmap_range : memory-map length bytes of file from offset
+ */
+static int
+mmap_range (int fd, void* addr, unsigned offset, unsigned length, int prot)
+{
+  struct file *file;
+
+  /* check window and protection. */
+  if( length == 0 || offset % PGSIZE != 0
+      || ( prot & ~( PROT_READ | PROT_WRITE ) ) != 0 )
     return -1;
 
   /* get file descriptor */
@@ -624,6 +733,28 @@ mmap (int fd, void* addr)
   if( file == NULL )
     return -1;
 
+  return do_mmap( file, addr, offset, length, ( prot & PROT_WRITE ) != 0 );
+}
+
+/*
+ * map length bytes of file from offset at addr : one region,
+ * pages get vme when touched. pages past end of file are zero.
+ * returns map_id, or -1.
+ */
+static int
+do_mmap (struct file *file, void *addr, off_t offset, size_t length,
+         bool writable)
+{
+  struct mmap_file *mmap_file;
+  struct vm_area *area;
+  off_t file_len;
+
+  /* check address */
+  if( (unsigned)addr < 0x8048000 
+      || (unsigned)addr >= 0xc0000000 
+      || pg_ofs( addr ) != 0)
+    return -1;
+
   /* create mmap_file */
   mmap_file = (struct mmap_file*) malloc (sizeof(struct mmap_file));
   if( mmap_file == NULL )
@@ -631,50 +762,56 @@ mmap (int fd, void* addr)
 
   /* initialize mmap_file */
   memset( mmap_file, 0, sizeof(struct mmap_file) );
-  mmap_file->map_id = thread_current()->mmap_id++;
   mmap_file->file = file_reopen( file );
-  list_init( &mmap_file->vme_list );
-
-  /* get length of file */
-  length = file_length( mmap_file->file );
-
-  /* while length = 0, create vm entry and add. */
-  while( length > 0 )
+  if( mmap_file->file == NULL )
   {
-    /* if already allocated area, return -1. */
-    if( find_vme( addr ) != NULL )
-      return -1;
+    free( mmap_file );
+    return -1;
+  }
 
-    /* create vm entry */
-    vme = (struct vm_entry*) malloc (sizeof(struct vm_entry));
-    if( vme == NULL )
-      return -1;
+  /* empty : nothing to map. */
+  if( length > 0 )
+  {
+    /* past user area : fail. */
+    if( length > 0xc0000000 - (unsigned)addr )
+      goto fail;
+
+    area = (struct vm_area*) malloc (sizeof(struct vm_area));
+    if( area == NULL )
+      goto fail;
+
+    file_len = file_length( mmap_file->file );
+
+    memset( area, 0, sizeof(struct vm_area) );
+    area->type = VM_FILE;
+    area->start = addr;
+    area->end = (uint8_t*)addr + ROUND_UP( length, PGSIZE );
+    area->writable = writable;
+    area->file = mmap_file->file;
+    area->offset = offset;
+    if( file_len > offset )
+      area->read_bytes = (size_t)( file_len - offset ) < length
+                         ? (size_t)( file_len - offset ) : length;
 
-    /* initialize vme */
-    memset( vme, 0, sizeof(struct vm_entry) );
-    vme->type = VM_FILE;
-    vme->vaddr = addr;
-    vme->writable = true;
-    vme->is_loaded = false;
-    vme->file = mmap_file->file;
-    vme->offset = 0;
-    vme->read_bytes = length > PGSIZE ? PGSIZE : length;
-    vme->zero_bytes = 0;
-
-    /* insert into mmap_file and current thread */
-    insert_vme( &thread_current()->vm, vme );
-    list_push_back( &mmap_file->vme_list, &vme->mmap_elem );
-
-    /* set length, offset */
-    length -= PGSIZE;
-    offset += PGSIZE;
-    addr += PGSIZE;
+    /* if already allocated area, return -1. */
+    if( insert_area( area ) == false )
+    {
+      free( area );
+      goto fail;
+    }
+    mmap_file->area = area;
   }
 
   /* insert into thread's mmap_list */
+  mmap_file->map_id = thread_current()->mmap_id++;
   list_push_back( &thread_current()->mmap_list, &mmap_file->elem );
 
   return mmap_file->map_id;
+
+ fail:
+  file_close( mmap_file->file );
+  free( mmap_file );
+  return -1;
 }
 
 /*
@@ -710,10 +847,192 @@ munmap( int map_id )
   }
 }
 
+/*
+ * System Call
+ * madvise : access hint for pages [addr, addr + length)
+ */
+static int
+madvise( void *addr, unsigned length, int advice )
+{
+  /* check address : page aligned, in user area. */
+  if( pg_ofs( addr ) != 0 || (unsigned)addr < 0x8048000
+      || length > (unsigned)PHYS_BASE - (unsigned)addr )
+    return -1;
 
+  return vm_advise( addr, length, advice ) ? 0 : -1;
+}
 
+/*
+ * System Call
+ * msync : write back dirty pages of mapping, now if MS_SYNC
+ */
+static int
+msync( int map_id, int flags )
+{
+  struct list_elem *e;
+  struct mmap_file *mmap_file;
+  bool found = false;
 
+  if( flags != MS_ASYNC && flags != MS_SYNC )
+    return -1;
 
+  for( e = list_begin( &thread_current()->mmap_list );
+       e != list_end( &thread_current()->mmap_list );
+       e = list_next( e ) )
+  {
+    mmap_file = list_entry( e, struct mmap_file, elem );
+
+    /* every piece of it. MS_ASYNC : flusher gets to it in time. */
+    if( mmap_file->map_id == map_id )
+    {
+      if( flags == MS_SYNC && mmap_file->area != NULL )
+        vm_msync( mmap_file->area );
+      found = true;
+    }
+  }
+
+  return found ? 0 : -1;
+}
+
+/*
+ * System Call
+ * munmap_range : unmap pages [addr, addr + length) of mappings.
+ * a mapping with a hole in the middle goes on as two pieces,
+ * both under its map_id.
+ */
+static int
+munmap_range( void *addr, unsigned length )
+{
+  struct list *mmap_list = &thread_current()->mmap_list;
+  struct list_elem *e;
+  struct mmap_file *head_map = NULL, *tail_map = NULL, *tail = NULL;
+  struct vm_area *hole;
+  uint8_t *start = addr;
+  uint8_t *end;
+
+  /* check address : page aligned, in user area. */
+  if( pg_ofs( addr ) != 0 || (unsigned)addr < 0x8048000
+      || length > (unsigned)PHYS_BASE - (unsigned)addr )
+    return -1;
+  end = start + ROUND_UP( length, PGSIZE );
 
+  /* at most two pieces are cut : the one around start, and the one
+     around end, maybe the same. */
+  for( e = list_begin( mmap_list ); e != list_end( mmap_list );
+       e = list_next( e ) )
+  {
+    struct mmap_file *mmap_file = list_entry( e, struct mmap_file, elem );
+    struct vm_area *area = mmap_file->area;
 
+    if( area != NULL && area->start < start && start < area->end )
+      head_map = mmap_file;
+    if( area != NULL && area->start < end && end < area->end )
+      tail_map = mmap_file;
+  }
 
+  /* cut them first : nothing is unmapped if that fails.
+     part after range : new piece, with its own file. */
+  if( tail_map != NULL )
+  {
+    tail = malloc (sizeof(struct mmap_file));
+    if( tail == NULL )
+      return -1;
+    memset( tail, 0, sizeof(struct mmap_file) );
+    tail->map_id = tail_map->map_id;
+    tail->file = file_reopen( tail_map->file );
+    if( tail->file == NULL
+        || ( tail->area = split_area( tail_map->area, end,
+                                      tail->file ) ) == NULL )
+    {
+      file_close( tail->file );
+      free( tail );
+      return -1;
+    }
+    list_insert( list_next( &tail_map->elem ), &tail->elem );
+  }
+
+  /* part before range : stays, the rest goes. */
+  if( head_map != NULL )
+  {
+    hole = split_area( head_map->area, start, head_map->area->file );
+    if( hole == NULL )
+    {
+      /* put part after range back. */
+      if( tail != NULL )
+      {
+        join_area( tail_map->area, tail->area );
+        list_remove( &tail->elem );
+        file_close( tail->file );
+        free( tail );
+      }
+      return -1;
+    }
+
+    /* write back and drop pages in range. */
+    vm_msync( hole );
+    remove_area( hole );
+  }
+
+  /* pieces left in range : nothing left of them. */
+  for( e = list_begin( mmap_list ); e != list_end( mmap_list ); )
+  {
+    struct mmap_file *mmap_file = list_entry( e, struct mmap_file, elem );
+    struct vm_area *area = mmap_file->area;
+
+    if( area == NULL || area->end <= start || end <= area->start )
+    {
+      e = list_next( e );
+      continue;
+    }
+
+    ASSERT( start <= area->start && area->end <= end );
+    do_munmap( mmap_file );
+    e = list_remove( e );
+    free( mmap_file );
+  }
+
+  return 0;
+}
+
+/*
+ * System Call
+ * vmstat : memory use of this process (pid 0) or of a child.
+ */
+static int
+vmstat( tid_t pid, struct vmstat *st )
+{
+  struct thread *t = thread_current();
+
+  if( pid != 0 && pid != t->tid )
+  {
+    t = get_child_process( pid );
+    if( t == NULL )
+      return -1;
+  }
+
+  st->faults = t->fault_cnt;
+  st->rss = t->rss;
+  st->rss_peak = t->rss_peak;
+  st->rss_limit = t->rss_limit;
+  st->wss = t->wss;
+
+  return 0;
+}
+
+/*
+ * System Call
+ * rss_limit : evict own pages beyond pages resident, 0 : no limit.
+ * a limit below RSS_LIMIT_MIN is raised to it.
+ * children made from now on get it too. returns old limit.
+ */
+static unsigned
+rss_limit( unsigned pages )
+{
+  struct thread *t = thread_current();
+  unsigned old = t->rss_limit;
+
+  if( pages != 0 && pages < RSS_LIMIT_MIN )
+    pages = RSS_LIMIT_MIN;
+  t->rss_limit = pages;
+  return old;
+}
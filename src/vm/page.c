@@ -1,11 +1,22 @@
 #include "vm/page.h"
+#include <stdio.h>
 #include <string.h>
 #include <debug.h>
+#include <round.h>
+#include <kernel/bitmap.h>
+#include <syscall-nr.h>
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/loader.h"
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
+#include "threads/pte.h"
 #include "threads/synch.h"
+#include "devices/timer.h"
 #include "filesys/file.h"
+#include "filesys/inode.h"
 #include "userprog/pagedir.h"
+#include "userprog/process.h"
 #include "vm/swap.h"
 
 /* Assignment 13 : lru list for pages */
@@ -13,15 +24,201 @@ struct list lru_list;
 struct lock lru_lock;
 struct list_elem* lru_clock;
 
+/* Assignment 13 : frame table, indexed by physical frame number.
+   holds the page descriptor of every frame : a fault allocates
+   none, and a free frame's descriptor is all zero. */
+static struct page* frame_table;
+static size_t frame_table_pages;
+
+/* lock for file I/O, from system calls. taken before lru_lock. */
+extern struct lock filesys_lock;
+
+/*
+ * Pending pages : a private page that was just loaded is queued
+ * here with interrupts off instead of being handed to the policy
+ * under lru_lock, so a fault never waits for the evictor writing
+ * out a batch.  The queue is drained under lru_lock before a
+ * victim is chosen.
+ */
+static struct list pending_list;
+
+/*
+ * Page-out daemon : keeps free user frames between the
+ * watermarks, so that faults rarely have to evict themselves.
+ */
+static struct semaphore pageout_sema;        /* wakes the daemon */
+static bool pageout_awake;                   /* already woken? */
+static size_t low_wmark, high_wmark;         /* free frame targets */
+static unsigned long long pageout_cnt;       /* evicted by daemon */
+static unsigned long long direct_cnt;        /* evicted by faults */
+
+/*
+ * Text page cache : read-only executable pages, keyed by inode
+ * sector and offset, so that processes running the same program
+ * map the same frames.  A page stays cached only while some
+ * process maps it, and a process keeps its executable open until
+ * its pages are gone, so the sector cannot be reused meanwhile.  A cached page lists every vm_entry mapping it;
+ * page->vme is just one of them.  Evicting it unmaps it from all
+ * of them and writes nothing, since executables are write-denied
+ * while running.
+ */
+static struct hash text_cache;
+static unsigned long long share_hit_cnt;     /* faults served by cache */
+
+/*
+ * Copy-on-write fork : the child maps every resident private page
+ * of its parent read-only, and both list each other as sharers.
+ * The first write copies the page, or just makes it writable if
+ * the writer is the last one left.  An evicted shared page goes
+ * to one swap slot, referenced by every sharer.
+ */
+static unsigned long long cow_share_cnt;     /* pages shared by fork */
+static unsigned long long cow_copy_cnt;      /* ... copied on write */
+
+/*
+ * Zero pages : untouched zero-fill pages are read from one shared,
+ * read-only zero frame, and get their own frame on first write.
+ * Evicted pages that are all zero are remembered as such instead
+ * of being written to swap.
+ */
+static void* zero_frame;                     /* shared zero frame */
+static unsigned long long zero_map_cnt;      /* faults served by it */
+static unsigned long long zero_cow_cnt;      /* ... copied on write */
+static unsigned long long zero_evict_cnt;    /* zero pages evicted */
+
+/*
+ * Swap readahead : on a swap fault, neighbouring pages that went
+ * to neighbouring swap slots are read too, but only mapped when
+ * they fault.  Until then they keep their swap slot, so dropping
+ * an unused one costs no write.  The window grows on hits and
+ * halves when a page read ahead is evicted unused.
+ */
+#define RA_MAX 8                             /* most pages read ahead */
+static size_t ra_window = 1;                 /* pages read ahead now */
+static unsigned long long ra_cnt;            /* pages read ahead */
+static unsigned long long ra_hit_cnt;        /* ... then faulted */
+static unsigned long long ra_miss_cnt;       /* ... then evicted */
+
+/*
+ * Fault-around : a fault in an executable or mapped file also maps
+ * the other pages of its aligned window in the same region.  Text
+ * pages another process has cached and zero pages cost no memory;
+ * the others are read from the file only while free frames are
+ * above the low watermark.
+ */
+size_t fault_around_pages = 8;               /* window, 0 : off */
+static unsigned long long fa_cnt;            /* pages mapped around */
+static unsigned long long fa_read_cnt;       /* ... read from file */
+
+/*
+ * Superpages : the first write to a zero-fill page maps its whole
+ * aligned 4 MB block with one large page, if no page of the block
+ * has been loaded yet and enough aligned free frames exist.  The
+ * block is kept by one descriptor in its region : its pages have
+ * no vm_entry and its frames no page, so the evictor leaves them
+ * alone.  The first use of one page on its own, find_vme(), fork
+ * or a DONTNEED of part of the block, splits it : every page then
+ * gets its vm_entry and page, and the page directory splits the
+ * large page the first time one of them changes.
+ */
+#define SUPERPAGE_PAGES ( PTSPAN / PGSIZE )  /* pages per superpage */
+bool superpage_enabled = true;               /* -nosuperpage : off */
+static unsigned long long superpage_cnt;     /* superpages mapped */
+static unsigned long long superpage_split_cnt; /* ... split later */
+
+struct superpage
+{
+  uint8_t* start;                    /* first page */
+  uint8_t* kaddr;                    /* first frame */
+  struct vm_area* area;              /* region holding it */
+  struct list_elem elem;             /* element for area's superpages */
+};
+
+/*
+ * Access hints : regions marked MADV_RANDOM get no fault-around or
+ * swap readahead.  MADV_SEQUENTIAL regions read further ahead of
+ * the fault, and drop pages two windows behind it, since a scan
+ * will not come back to them.
+ */
+#define SEQ_FACTOR 4                         /* sequential window */
+static unsigned long long drop_behind_cnt;   /* dropped behind scan */
+static unsigned long long dontneed_cnt;      /* dropped by DONTNEED */
+static unsigned long long willneed_cnt;      /* loaded by WILLNEED */
+
+/*
+ * Flusher : every flush_secs seconds, writes back dirty pages of
+ * mapped files, so that a crash loses at most that much and munmap
+ * has little left to write.  msync() does the same for one mapping.
+ * Pages are written in batches sorted by file and offset, with the
+ * dirty bit cleared first : a write meanwhile dirties it again.
+ * A batch is written under filesys_lock but not lru_lock, its pages
+ * pinned meanwhile; munmap waits for it at filesys_lock in msync.
+ */
+#define FLUSH_BATCH 16                       /* pages per batch */
+int flush_secs = 5;                          /* period, 0 : off */
+static unsigned long long flush_cnt;         /* written by flusher */
+static unsigned long long msync_cnt;         /* written by msync */
+
+/*
+ * Working set : every ws_secs seconds, if turned on, the sampler
+ * counts for each process the resident pages it used since the
+ * last sample, by taking their accessed bits.  A page whose bit it
+ * took is marked referenced, so the replacement policy still sees
+ * the use.  It scans the frame table WS_BATCH frames at a time,
+ * letting faults in between.
+ * Resident pages are charged to every process mapping them.  A
+ * process at its resident-set limit evicts its own private pages
+ * before it takes a frame, so it cannot push others out.
+ */
+#define WS_BATCH 64                          /* frames per lru_lock */
+int ws_secs = 0;                             /* period, 0 : off */
+static size_t own_hand;                      /* frame own_victim() is at */
+static unsigned long long limit_evict_cnt;   /* evicted by own limit */
+
+/* pages gathered by one eviction pass. */
+#define EVICT_BATCH 8
+
+/* eviction attempts before alloc_page() fails. */
+#define ALLOC_TRIES 64
+
 static struct page* get_victim_page( void );
+static bool evict_page( struct thread* owner, unsigned long long* cnt );
 static void* try_to_get_page( enum palloc_flags flag );
+static void pageout_daemon( void* aux UNUSED );
+static void flusher( void* aux UNUSED );
+static void ws_sampler( void* aux UNUSED );
+static void charge_rss( struct thread* t, int pages );
+static bool fs_lock( void );
+static void fs_unlock( bool taken );
+static bool page_needs_flush( struct page* page );
+static void write_back( struct page** pages, size_t n );
+static void flush_victims( struct page** pages, struct vm_entry** vmes,
+                           size_t n );
+static bool page_pinned( struct page* page );
 static void __free_page( struct page* page );
+static void release_frame( struct page* page );
+static void link_page( struct page* page );
+static struct page* frame_desc( void* kaddr );
+static void drain_pending( void );
+static bool leave_page( struct page* page, struct vm_entry* vme );
 
 static unsigned vm_hash_func( const struct hash_elem *e, void *aux UNUSED );
 static bool vm_less_func( const struct hash_elem *a,
                           const struct hash_elem *b,
                           void *aux UNUSED );
 static void vm_destroy_func( struct hash_elem *e, void *aux UNUSED );
+static struct vm_entry* lookup_vme( void *vaddr );
+static struct vm_entry* make_area_vme( struct vm_area *area, void *upage );
+static struct superpage* find_superpage( struct vm_area* area,
+                                         const void* vaddr );
+static bool split_superpage( struct superpage* sp );
+static void release_superpage( struct superpage* sp );
+static void drop_behind( uint8_t* start, uint8_t* end );
+static bool add_area_at( struct thread* t, size_t i, struct vm_area* area );
+static unsigned text_hash_func( const struct hash_elem *e, void *aux UNUSED );
+static bool text_less_func( const struct hash_elem *a,
+                            const struct hash_elem *b,
+                            void *aux UNUSED );
 
 /*
  * Assignment 11 : initialize vm_table
@@ -72,8 +269,34 @@ bool delete_vme( struct hash *vm, struct vm_entry *vme )
 
 /*
  * Assignment 11 : find vme
+ * page of a region touched first time : make its vme.
+ * page of a superpage : split it, so every page has its vme.
  */
 struct vm_entry* find_vme( void *vaddr )
+{
+  struct vm_entry* vme;
+  struct vm_area* area;
+  struct superpage* sp;
+
+  vme = lookup_vme( vaddr );
+  if( vme != NULL )
+    return vme;
+
+  area = find_area( vaddr );
+  if( area == NULL )
+    return NULL;
+
+  sp = find_superpage( area, vaddr );
+  if( sp != NULL )
+    return split_superpage( sp ) ? lookup_vme( vaddr ) : NULL;
+
+  return make_area_vme( area, pg_round_down( vaddr ) );
+}
+
+/*
+ * find vme already made, without looking at regions.
+ */
+static struct vm_entry* lookup_vme( void *vaddr )
 {
   struct vm_entry key;
   struct hash_elem *found;
@@ -91,307 +314,2795 @@ struct vm_entry* find_vme( void *vaddr )
 }
 
 /*
- * Assignment 11 : destroy vm table
+ * make vme of page upage in area. returns NULL if out of memory.
  */
-void vm_destroy( struct hash *vm )
+static struct vm_entry* make_area_vme( struct vm_area *area, void *upage )
 {
-  hash_destroy( vm, vm_destroy_func );
+  struct vm_entry* vme;
+  size_t ofs = (uint8_t*)upage - area->start;
+
+  vme = (struct vm_entry*) malloc (sizeof(struct vm_entry));
+  if( vme == NULL )
+    return NULL;
+
+  /* file up to read_bytes, zero after. */
+  memset( vme, 0, sizeof(struct vm_entry) );
+  vme->type = area->type;
+  vme->vaddr = upage;
+  vme->writable = area->writable;
+  vme->file = area->file;
+  vme->offset = area->offset + ofs;
+  if( ofs < area->read_bytes )
+    vme->read_bytes = area->read_bytes - ofs < PGSIZE
+                      ? area->read_bytes - ofs : PGSIZE;
+  vme->zero_bytes = PGSIZE - vme->read_bytes;
+  vme->is_zero = ( vme->read_bytes == 0 );
+  vme->area = area;
+
+  insert_vme( &thread_current()->vm, vme );
+  list_push_back( &area->vme_list, &vme->area_elem );
+
+  return vme;
 }
 
 /*
- * Assignment 11 : function for free-ing vm_entry
+ * index of first region of t ending after vaddr.
  */
-static void vm_destroy_func( struct hash_elem *e, void *aux UNUSED )
+static size_t area_index( struct thread* t, const void* vaddr )
 {
-  struct vm_entry* vme;
-  struct page* page;
-  struct list_elem* elem;
-
-  /* get current vm_entry */
-  vme = hash_entry( e, struct vm_entry, elem );
+  size_t lo = 0, hi = t->area_cnt;
 
-  lock_acquire( &lru_lock );
-
-  /* search through lru list */
-  for( elem = list_begin( &lru_list );
-       elem != list_end( &lru_list );
-       /* empty */ )
+  /* binary search : regions do not overlap. */
+  while( lo < hi )
   {
-    /* get page from list */
-    page = list_entry( elem, struct page, lru_elem );
-    elem = list_next( elem );
+    size_t mid = lo + ( hi - lo ) / 2;
 
-    /* if page holds this vme, delete page from list. */
-    if( page->vme == vme )
-    {
-      __free_page( page );
-    }
+    if( t->areas[mid]->end <= (const uint8_t*)vaddr )
+      lo = mid + 1;
+    else
+      hi = mid;
   }
 
-  lock_release( &lru_lock );
-
-  free( vme );
+  return lo;
 }
 
 /*
- * Assignment 11 : load file to page
+ * find region of current process holding vaddr.
  */
-bool load_file( void *kpage, struct vm_entry *vme )
+struct vm_area* find_area( const void *vaddr )
 {
-  /* load the page. */
-  if( file_read_at( vme->file, kpage, vme->read_bytes, vme->offset ) 
-      != (int)vme->read_bytes )
+  struct thread* t = thread_current();
+  struct vm_area* area = t->area_cache;
+  size_t i;
+
+  /* faults come in runs : try region found last time. */
+  if( area != NULL && area->start <= (const uint8_t*)vaddr
+      && (const uint8_t*)vaddr < area->end )
+    return area;
+
+  i = area_index( t, vaddr );
+  if( i < t->area_cnt && t->areas[i]->start <= (const uint8_t*)vaddr )
   {
-    return false;
+    t->area_cache = t->areas[i];
+    return t->areas[i];
   }
 
-  /* set zero bytes. */
-  memset( kpage + vme->read_bytes, 0, vme->zero_bytes );
-
-  return true;
+  return NULL;
 }
 
 /*
- * Assignment 12 : do_munmap
+ * add region to current process. returns false if it overlaps
+ * another region or page, or if out of memory.
  */
-void do_munmap( struct mmap_file *mmap_file )
+bool insert_area( struct vm_area *area )
 {
-  struct list_elem *ex;
-  struct vm_entry *vme;
-  struct list_elem *elem;
-  struct page *page;
+  struct thread* t = thread_current();
+  size_t pages = ( area->end - area->start ) / PGSIZE;
+  size_t i;
 
-  /* remove all vmes */
-  for( ex = list_begin( &mmap_file->vme_list );
-       ex != list_end( &mmap_file->vme_list );
-       /* empty */ )
-  {
-    vme = list_entry( ex, struct vm_entry, mmap_elem );
-
-    /* if page is dirty, write on file. */
-    if( pagedir_is_dirty( thread_current()->pagedir, vme->vaddr ) )
-    {
-      file_write_at( vme->file, vme->vaddr, vme->read_bytes, vme->offset );
-    }
+  ASSERT( pg_ofs( area->start ) == 0 && pg_ofs( area->end ) == 0 );
+  ASSERT( area->start < area->end );
 
-    /* remove from list */  
-    ex = list_remove( ex );
+  /* overlaps next region? */
+  i = area_index( t, area->start );
+  if( i < t->area_cnt && t->areas[i]->start < area->end )
+    return false;
 
-    lock_acquire( &lru_lock );
+  /* overlaps page outside any region, like stack? look at
+     whichever is fewer : those pages, or the region's. */
+  if( hash_size( &t->vm ) < pages )
+  {
+    struct hash_iterator it;
 
-    /* search through lru list, find for page. */
-    for( elem = list_begin( &lru_list );
-         elem != list_end( &lru_list );
-         elem = list_next( elem ) )
+    hash_first( &it, &t->vm );
+    while( hash_next( &it ) )
     {
-      /* get page from list */
-      page = list_entry( elem, struct page, lru_elem );
-
-      /* if page holds this vme, free page and break. */
-      if( page->vme == vme )
-      {
-        __free_page( page );
-        break;
-      }
+      uint8_t* vaddr = hash_entry( hash_cur( &it ), struct vm_entry,
+                                   elem )->vaddr;
+      if( area->start <= vaddr && vaddr < area->end )
+        return false;
     }
+  }
+  else
+  {
+    uint8_t* vaddr;
 
-    lock_release( &lru_lock );
-
-    delete_vme( &thread_current()->vm, vme );
-    free( vme );
+    for( vaddr = area->start; vaddr < area->end; vaddr += PGSIZE )
+      if( lookup_vme( vaddr ) != NULL )
+        return false;
   }
-}
 
+  if( add_area_at( t, i, area ) == false )
+    return false;
+  list_init( &area->vme_list );
+  list_init( &area->superpages );
+
+  return true;
+}
 
 /*
- * Assignment 13 : initialize lru
+ * put area at index i of t's regions. returns false if out of memory.
  */
-void lru_init()
+static bool add_area_at( struct thread* t, size_t i, struct vm_area* area )
 {
-  list_init( &lru_list );
-  lock_init( &lru_lock );
-  lru_clock = NULL;
+  /* grow array if full. */
+  if( t->area_cnt == t->area_max )
+  {
+    size_t max = t->area_max ? t->area_max * 2 : 4;
+    struct vm_area** areas = realloc( t->areas, max * sizeof *areas );
+
+    if( areas == NULL )
+      return false;
+    t->areas = areas;
+    t->area_max = max;
+  }
+
+  memmove( t->areas + i + 1, t->areas + i,
+           ( t->area_cnt - i ) * sizeof *t->areas );
+  t->areas[i] = area;
+  t->area_cnt++;
+
+  return true;
 }
 
 /*
- * Assignment 13 : adding page to list
+ * grow anonymous region down to page start. returns false if it
+ * would overlap region below.
  */
-void add_page_to_list( struct page* page )
+bool extend_area( struct vm_area *area, void *start )
 {
-  lock_acquire( &lru_lock );
+  struct thread* t = thread_current();
+  size_t i = area_index( t, area->start );
 
-  /* add this page's lru to list. */
-  list_push_back( &lru_list, &page->lru_elem );
+  ASSERT( area->type == VM_ANON && pg_ofs( start ) == 0 );
+  ASSERT( i < t->area_cnt && t->areas[i] == area );
 
-  lock_release( &lru_lock );
+  if( (uint8_t*)start >= area->start )
+    return true;
+  if( i > 0 && t->areas[i-1]->end > (uint8_t*)start )
+    return false;
+
+  area->start = start;
+  return true;
 }
 
 /*
- * Assignment 13 : deleting page from list
- * required :
- *   if clock pointing to argument, move to next.
+ * split region at page at : area keeps [start, at), returned new
+ * region gets [at, end) and its vmes, mapping file.
+ * returns NULL if out of memory.
  */
-void delete_page_from_list( struct page* page )
+struct vm_area* split_area( struct vm_area *area, void *at,
+                            struct file *file )
 {
-  /* check if clock pointing to this page. */
-  if( lru_clock == &page->lru_elem )
+  struct thread* t = thread_current();
+  struct vm_area* tail;
+  struct list_elem* e;
+  size_t head_size = (uint8_t*)at - area->start;
+
+  ASSERT( pg_ofs( at ) == 0 );
+  ASSERT( area->start < (uint8_t*)at && (uint8_t*)at < area->end );
+  ASSERT( list_empty( &area->superpages ) );
+
+  tail = (struct vm_area*) malloc (sizeof(struct vm_area));
+  if( tail == NULL )
+    return NULL;
+
+  *tail = *area;
+  tail->start = at;
+  tail->file = file;
+  tail->offset = area->offset + head_size;
+  tail->read_bytes = area->read_bytes > head_size
+                     ? area->read_bytes - head_size : 0;
+  list_init( &tail->vme_list );
+  list_init( &tail->superpages );
+
+  if( add_area_at( t, area_index( t, area->start ) + 1, tail ) == false )
+  {
+    free( tail );
+    return NULL;
+  }
+  area->end = at;
+  if( area->read_bytes > head_size )
+    area->read_bytes = head_size;
+
+  /* move vmes past at. flusher reads their file : lru_lock. */
+  lock_acquire( &lru_lock );
+  for( e = list_begin( &area->vme_list ); e != list_end( &area->vme_list ); )
   {
-    lru_clock = list_remove( lru_clock );
+    struct vm_entry* vme = list_entry( e, struct vm_entry, area_elem );
 
-    /* if clock at end of list, set to NULL. */
-    if( lru_clock == list_end( &lru_list ) )
-      lru_clock = NULL;
+    if( (uint8_t*)vme->vaddr < (uint8_t*)at )
+    {
+      e = list_next( e );
+      continue;
+    }
+    e = list_remove( e );
+    list_push_back( &tail->vme_list, &vme->area_elem );
+    vme->area = tail;
+    vme->file = file;
   }
-  else
-    list_remove( &page->lru_elem );
+  lock_release( &lru_lock );
+
+  return tail;
 }
 
 /*
- * Assignment 13 : allocating page
- * WARNING - member 'vme' and 'lru_elem' should be handled
- *           out of this page.
+ * undo split_area() : area takes back tail, the region right after
+ * it, and its vmes, mapping area's file again. tail is freed.
  */
-struct page* alloc_page( enum palloc_flags flag )
+void join_area( struct vm_area *area, struct vm_area *tail )
 {
-  void* kaddr;
-  struct page* page;
+  struct thread* t = thread_current();
+  size_t i = area_index( t, tail->start );
+  size_t head_size = tail->start - area->start;
 
-  /* allocate kernel memory. */
-  /* if no more, try to free a page. */
-  kaddr = palloc_get_page( flag );
-  while( kaddr == NULL )
-    kaddr = try_to_get_page( flag );
+  ASSERT( area->end == tail->start );
+  ASSERT( i < t->area_cnt && t->areas[i] == tail );
 
-  /* initialize page */
-  page = (struct page*) malloc (sizeof(struct page));
-  memset( page, 0, sizeof(struct page) );
+  /* flusher reads their file : lru_lock. */
+  lock_acquire( &lru_lock );
+  while( list_empty( &tail->vme_list ) == false )
+  {
+    struct vm_entry* vme = list_entry( list_pop_front( &tail->vme_list ),
+                                       struct vm_entry, area_elem );
+    list_push_back( &area->vme_list, &vme->area_elem );
+    vme->area = area;
+    vme->file = area->file;
+  }
+  lock_release( &lru_lock );
 
-  page->kaddr = kaddr;
-  page->thread = thread_current();
+  area->end = tail->end;
+  if( tail->read_bytes > 0 )
+    area->read_bytes = head_size + tail->read_bytes;
 
-  return page;
+  memmove( t->areas + i, t->areas + i + 1,
+           ( t->area_cnt - i - 1 ) * sizeof *t->areas );
+  t->area_cnt--;
+  if( t->area_cache == tail )
+    t->area_cache = NULL;
+  free( tail );
 }
 
 /*
- * Assignment 13 : try to free victim, and get page.
+ * remove region from current process, freeing its pages and area.
  */
-static void* try_to_get_page( enum palloc_flags flag )
+void remove_area( struct vm_area *area )
 {
-  struct page* victim;
-  bool is_dirty;
-
-  lock_acquire( &lru_lock );
+  struct thread* t = thread_current();
+  size_t i = area_index( t, area->start );
 
-  /* get victim */
-  victim = get_victim_page();
+  ASSERT( i < t->area_cnt && t->areas[i] == area );
 
-  /* get if page is dirty */
-  is_dirty = pagedir_is_dirty( victim->thread->pagedir, victim->vme->vaddr );
+  while( list_empty( &area->superpages ) == false )
+    release_superpage( list_entry( list_front( &area->superpages ),
+                                   struct superpage, elem ) );
 
-  /* switch by vme type */
-  switch( victim->vme->type )
+  while( list_empty( &area->vme_list ) == false )
   {
-    case VM_BIN:
-      /* if dirty, write to file. */
-      if( is_dirty == true )
-      {
-        file_write_at( victim->vme->file, victim->vme->vaddr,
-                       victim->vme->read_bytes, victim->vme->offset );
-      }
+    struct vm_entry* vme = list_entry( list_pop_front( &area->vme_list ),
+                                       struct vm_entry, area_elem );
 
-      /* switch type to VM_ANON. */
-      victim->vme->type = VM_ANON;
+    /* free the frame holding it, if any. */
+    free_vme_page( vme );
+    delete_vme( &t->vm, vme );
+    free( vme );
+  }
 
-      /* set swap slot. */
-      victim->vme->swap_slot = swap_out( victim->kaddr );
+  memmove( t->areas + i, t->areas + i + 1,
+           ( t->area_cnt - i - 1 ) * sizeof *t->areas );
+  t->area_cnt--;
+  if( t->area_cache == area )
+    t->area_cache = NULL;
+  free( area );
+}
 
-      break;
+/*
+ * Assignment 11 : destroy vm table
+ */
+void vm_destroy( struct hash *vm )
+{
+  struct thread* t = thread_current();
+  size_t i;
 
-    case VM_FILE:
-      /* if dirty, write to file. */
-      if( is_dirty == true )
-      {
-        file_write_at( victim->vme->file, victim->vme->vaddr,
-                       victim->vme->read_bytes, victim->vme->offset );
-      }
-      break;
+  hash_destroy( vm, vm_destroy_func );
 
-    case VM_ANON:
-      /* always set swap slot. */
-      victim->vme->swap_slot = swap_out( victim->kaddr );
-      break;
+  /* vmes are gone : free superpages and regions. */
+  for( i=0; i<t->area_cnt; i++ )
+  {
+    struct vm_area* area = t->areas[i];
+
+    while( list_empty( &area->superpages ) == false )
+      release_superpage( list_entry( list_front( &area->superpages ),
+                                     struct superpage, elem ) );
+    free( area );
   }
+  free( t->areas );
+  t->areas = NULL;
+  t->area_cnt = t->area_max = 0;
+  t->area_cache = NULL;
+}
 
-  /* unloaded from now on. */
-  victim->vme->is_loaded = false;
+/*
+ * Assignment 11 : function for free-ing vm_entry
+ */
+static void vm_destroy_func( struct hash_elem *e, void *aux UNUSED )
+{
+  struct vm_entry* vme;
 
-  __free_page( victim );
+  /* get current vm_entry */
+  vme = hash_entry( e, struct vm_entry, elem );
 
-  lock_release( &lru_lock );
+  /* free the frame holding it, if any. */
+  free_vme_page( vme );
 
-  return palloc_get_page( flag );
+  free( vme );
 }
 
 /*
- * Assignment 13 : getting victim page from list
+ * take filesys_lock for file I/O, unless current thread holds it
+ * already : a fault inside the file system. returns true if taken.
  */
-static struct page* get_victim_page()
+static bool fs_lock( void )
 {
-  struct list_elem* e;
-  struct page* page;
+  if( lock_held_by_current_thread( &filesys_lock ) )
+    return false;
+  lock_acquire( &filesys_lock );
+  return true;
+}
 
-  /* if clock not NULL, set elem to list_begin. */
-  e = ( lru_clock != NULL ) ? lru_clock : list_begin( &lru_list );
+static void fs_unlock( bool taken )
+{
+  if( taken )
+    lock_release( &filesys_lock );
+}
 
-  /* get page descriptor */
-  page = list_entry( e, struct page, lru_elem );
+/*
+ * Assignment 11 : load file to page
+ */
+bool load_file( void *kpage, struct vm_entry *vme )
+{
+  bool taken = fs_lock();
+  off_t bytes = file_read_at( vme->file, kpage, vme->read_bytes,
+                              vme->offset );
+  fs_unlock( taken );
 
-  while( page->vme->is_pinned == false &&
-         pagedir_is_accessed( page->thread->pagedir, page->vme->vaddr ) )
+  /* load the page. */
+  if( bytes != (int)vme->read_bytes )
   {
-    /* if page is accessed, set to 'unaccessed'. */
-    pagedir_set_accessed( page->thread->pagedir, page->vme->vaddr, false );
+    return false;
+  }
 
-    /* switch to next element. */
-    e = list_next( e );
+  /* set zero bytes. */
+  memset( kpage + vme->read_bytes, 0, vme->zero_bytes );
 
-    /* if e at the end of list, set to list begin. */
-    if( e == list_end( &lru_list ) )
-      e = list_begin( &lru_list );
+  return true;
+}
 
-    /* get page descriptor */
-    page = list_entry( e, struct page, lru_elem );
-  }
+/*
+ * Assignment 12 : do_munmap
+ */
+void do_munmap( struct mmap_file *mmap_file )
+{
+  /* empty file : nothing mapped. */
+  if( mmap_file->area != NULL )
+  {
+    /* if pages are dirty, write on file. */
+    vm_msync( mmap_file->area );
 
-  lru_clock = e;
+    /* remove all vmes */
+    remove_area( mmap_file->area );
+    mmap_file->area = NULL;
+  }
 
-  return page;
+  /* each mapping has its own reopened file. */
+  file_close( mmap_file->file );
+  mmap_file->file = NULL;
 }
 
+
 /*
- * Assignment 13 : free page for outside of this source
+ * Page replacement policies.
+ *
+ * Every resident user page is handed to the current policy when
+ * it is added to or removed from the replacement lists, and the
+ * policy picks the victim when a frame is needed.  All of this
+ * happens under lru_lock; private pages just loaded reach the
+ * policy a little later, through pending_list.  A policy never
+ * picks a pinned page; it returns NULL if it cannot find anything
+ * to evict.
+ *
+ *   clock    : one hand sweeps lru_list, clearing accessed bits
+ *              and evicting the first page found unaccessed.
+ *   clock2   : two-handed clock.  The front hand clears accessed
+ *              bits, and the back hand, a quarter of the list
+ *              behind, evicts pages not touched since.  Eviction
+ *              cost is bounded even when every page is hot.
+ *   clockpro : CLOCK-Pro.  Resident pages are hot or cold; new
+ *              pages start cold and in their test period.  A cold
+ *              page referenced again during its test period turns
+ *              hot.  Evicted test-period pages are remembered as
+ *              non-resident "ghosts"; faulting one back in means
+ *              its reuse distance was short, so it comes back hot
+ *              and the cold share grows.  Ghosts that expire
+ *              unused shrink the cold share again.
  */
-void free_page( struct page* page )
+struct replace_policy
 {
-  lock_acquire( &lru_lock );
-  __free_page( page );
-  lock_release( &lru_lock );
+  const char* name;                          /* name for -vmpolicy */
+  void (*add)( struct page* page );          /* page became resident */
+  void (*remove)( struct page* page );       /* page is going away */
+  struct page* (*victim)( void );            /* choose page to evict */
+};
+
+static void clock_add( struct page* page );
+static void clock_remove( struct page* page );
+static struct page* clock_victim( void );
+static struct page* clock2_victim( void );
+static void clockpro_add( struct page* page );
+static void clockpro_remove( struct page* page );
+static struct page* clockpro_victim( void );
+static void clockpro_forget( struct vm_entry* vme );
+
+static const struct replace_policy policies[] =
+{
+  { "clock", clock_add, clock_remove, clock_victim },
+  { "clock2", clock_add, clock_remove, clock2_victim },
+  { "clockpro", clockpro_add, clockpro_remove, clockpro_victim },
+};
+
+/* policy in use. */
+static const struct replace_policy* policy = &policies[0];
+
+/* replacement statistics. */
+static unsigned long long evict_cnt;         /* pages evicted */
+static unsigned long long scan_cnt;          /* pages examined */
+static unsigned long long scan_max;          /* most examined at once */
+static size_t scans;                         /* examined this time */
+
+/* two-handed clock : front hand, clears accessed bits. */
+static struct list_elem* clock_front;
+
+/* CLOCK-Pro lists and sizes. */
+static struct list hot_list;                 /* resident hot pages */
+static struct list cold_list;                /* resident cold pages */
+static struct list ghost_list;               /* evicted test pages */
+static size_t hot_cnt, cold_cnt, ghost_cnt;
+static size_t cold_target;                   /* adaptive cold share */
+
+/*
+ * Assignment 13 : initialize lru
+ */
+void lru_init()
+{
+  list_init( &lru_list );
+  list_init( &pending_list );
+  lock_init( &lru_lock );
+  lru_clock = NULL;
+  clock_front = NULL;
+
+  list_init( &hot_list );
+  list_init( &cold_list );
+  list_init( &ghost_list );
+  cold_target = 1;
+
+  /* one descriptor per physical frame. */
+  frame_table_pages = DIV_ROUND_UP( init_ram_pages * sizeof *frame_table,
+                                    PGSIZE );
+  frame_table = palloc_get_multiple( PAL_ASSERT | PAL_ZERO,
+                                     frame_table_pages );
+
+  /* never written : mapped read-only only. */
+  zero_frame = palloc_get_page( PAL_ASSERT | PAL_ZERO );
+
+  hash_init( &text_cache, text_hash_func, text_less_func, NULL );
 }
 
 /*
- * Assignment 13 : free page descriptor, delete page entry
+ * text page cache : hash by inode sector and offset.
  */
-static void __free_page( struct page* page )
+static unsigned text_hash_func( const struct hash_elem *e, void *aux UNUSED )
+{
+  const struct page* page = hash_entry( e, struct page, cache_elem );
+  return hash_int( page->sector ) ^ hash_int( page->offset );
+}
+
+static bool text_less_func( const struct hash_elem *a,
+                            const struct hash_elem *b,
+                            void *aux UNUSED )
 {
-  /* delete from list */
-  delete_page_from_list( page );
+  const struct page* pa = hash_entry( a, struct page, cache_elem );
+  const struct page* pb = hash_entry( b, struct page, cache_elem );
 
-  /* deallocate page from kernel, delete entry of page directory. */
-  pagedir_clear_page( page->thread->pagedir, page->vme->vaddr );
-  palloc_free_page( page->kaddr );
+  if( pa->sector != pb->sector )
+    return pa->sector < pb->sector;
+  return pa->offset < pb->offset;
+}
+
+/*
+ * read-only code or data from executable?
+ */
+static bool is_text( struct vm_entry* vme )
+{
+  return vme->type == VM_BIN && vme->writable == false
+         && vme->is_zero == false;
+}
+
+/*
+ * mapped by every vm_entry on page->sharers?
+ */
+static bool is_shared( struct page* page )
+{
+  return page->in_cache || page->is_cow;
+}
+
+/*
+ * text fault : map the copy some process already has.
+ * returns false if there is none.
+ */
+bool map_shared_page( struct vm_entry* vme )
+{
+  struct page key;
+  struct hash_elem* e;
+  bool success = false;
+
+  if( is_text( vme ) == false )
+    return false;
+
+  key.sector = inode_get_inumber( file_get_inode( vme->file ) );
+  key.offset = vme->offset;
+
+  lock_acquire( &lru_lock );
+
+  e = hash_find( &text_cache, &key.cache_elem );
+  if( e != NULL )
+  {
+    struct page* page = hash_entry( e, struct page, cache_elem );
+
+    if( pagedir_set_page( thread_current()->pagedir, vme->vaddr,
+                          page->kaddr, false ) )
+    {
+      list_push_back( &page->sharers, &vme->share_elem );
+      vme->thread = thread_current();
+      vme->page = page;
+      vme->is_loaded = true;
+      charge_rss( vme->thread, 1 );
+      share_hit_cnt++;
+      success = true;
+    }
+  }
+
+  lock_release( &lru_lock );
+
+  return success;
+}
+
+/*
+ * text page just loaded : enter into cache, unless another
+ * process loaded it meanwhile. lru_lock must be held.
+ */
+static void cache_text_page( struct page* page )
+{
+  struct vm_entry* vme = page->vme;
+
+  page->sector = inode_get_inumber( file_get_inode( vme->file ) );
+  page->offset = vme->offset;
+
+  if( hash_insert( &text_cache, &page->cache_elem ) == NULL )
+  {
+    page->in_cache = true;
+    list_init( &page->sharers );
+    list_push_back( &page->sharers, &vme->share_elem );
+    vme->thread = page->thread;
+  }
+}
+
+/*
+ * unmap page from everyone mapping it.
+ */
+static void unmap_page( struct page* page )
+{
+  struct list_elem* e;
+
+  if( is_shared( page ) == false )
+  {
+    pagedir_clear_page( page->thread->pagedir, page->vme->vaddr );
+    return;
+  }
+
+  for( e = list_begin( &page->sharers ); e != list_end( &page->sharers );
+       e = list_next( e ) )
+  {
+    struct vm_entry* vme = list_entry( e, struct vm_entry, share_elem );
+    pagedir_clear_page( vme->thread->pagedir, vme->vaddr );
+  }
+}
+
+/*
+ * map page again for everyone, read-only while shared.
+ */
+static void remap_page( struct page* page )
+{
+  struct list_elem* e;
+
+  if( is_shared( page ) == false )
+  {
+    pagedir_set_page( page->thread->pagedir, page->vme->vaddr,
+                      page->kaddr, page->vme->writable );
+    return;
+  }
+
+  for( e = list_begin( &page->sharers ); e != list_end( &page->sharers );
+       e = list_next( e ) )
+  {
+    struct vm_entry* vme = list_entry( e, struct vm_entry, share_elem );
+    pagedir_set_page( vme->thread->pagedir, vme->vaddr, page->kaddr, false );
+  }
+}
+
+/*
+ * evicted page is anonymous from now on : in swap_slot, or all
+ * zero. shared since fork : every sharer refers to the slot.
+ */
+static void set_anon( struct page* page, size_t swap_slot, bool is_zero )
+{
+  struct list_elem* e;
+
+  page->vme->type = VM_ANON;
+  page->vme->swap_slot = swap_slot;
+  page->vme->is_zero = is_zero;
+
+  if( is_shared( page ) == false )
+    return;
+
+  for( e = list_begin( &page->sharers ); e != list_end( &page->sharers );
+       e = list_next( e ) )
+  {
+    struct vm_entry* vme = list_entry( e, struct vm_entry, share_elem );
+
+    if( vme == page->vme )
+      continue;
+    vme->type = VM_ANON;
+    vme->swap_slot = swap_slot;
+    vme->is_zero = is_zero;
+    if( is_zero == false )
+      swap_dup( swap_slot );
+  }
+}
+
+/*
+ * vme stops mapping shared page. returns true if it was the last
+ * one : caller frees the page. lru_lock must be held.
+ */
+static bool leave_page( struct page* page, struct vm_entry* vme )
+{
+  list_remove( &vme->share_elem );
+  pagedir_clear_page( vme->thread->pagedir, vme->vaddr );
+  vme->page = NULL;
+  charge_rss( vme->thread, -1 );
+
+  if( list_empty( &page->sharers ) )
+    return true;
+
+  if( page->vme == vme )
+  {
+    page->vme = list_entry( list_front( &page->sharers ),
+                            struct vm_entry, share_elem );
+    page->thread = page->vme->thread;
+  }
+  return false;
+}
+
+/*
+ * map page into current process for vme, read-only, and make
+ * everyone else map it read-only too. lru_lock must be held.
+ */
+static bool share_page( struct page* page, struct vm_entry* vme )
+{
+  if( pagedir_set_page( thread_current()->pagedir, vme->vaddr,
+                        page->kaddr, false ) == false )
+    return false;
+
+  /* first time shared : owner starts the sharers list. */
+  if( is_shared( page ) == false )
+  {
+    list_init( &page->sharers );
+    list_push_back( &page->sharers, &page->vme->share_elem );
+    page->vme->thread = page->thread;
+  }
+
+  /* private page : nobody writes it from now on. */
+  if( page->in_cache == false && page->is_cow == false )
+  {
+    pagedir_set_writable( page->thread->pagedir, page->vme->vaddr, false );
+    page->is_cow = true;
+  }
+
+  list_push_back( &page->sharers, &vme->share_elem );
+  vme->thread = thread_current();
+  vme->page = page;
+  vme->is_loaded = true;
+  charge_rss( vme->thread, 1 );
+
+  return true;
+}
+
+/*
+ * fork : make vme, of the current process, a copy of parent's vme.
+ * resident pages are shared until written, swapped out pages
+ * share their swap slot. returns false if out of memory.
+ */
+bool fork_vme( struct vm_entry* vme, struct vm_entry* parent )
+{
+  struct page* page;
+  bool success = true;
+  bool taken = false;
+
+  memset( vme, 0, sizeof *vme );
+  vme->type = parent->type;
+  vme->vaddr = parent->vaddr;
+  vme->writable = parent->writable;
+  vme->file = parent->file;
+  vme->offset = parent->offset;
+  vme->read_bytes = parent->read_bytes;
+  vme->zero_bytes = parent->zero_bytes;
+  vme->swap_slot = parent->swap_slot;
+  vme->is_zero = parent->is_zero;
+
+  /* mapped file may be written back. */
+  if( parent->type == VM_FILE )
+    taken = fs_lock();
+  lock_acquire( &lru_lock );
+
+  page = parent->page;
+
+  /* read ahead, not mapped yet : still in its swap slot. */
+  if( page != NULL && page->is_readahead )
+    swap_dup( parent->swap_slot );
+  /* memory-mapped file : child reads it again, see parent's writes. */
+  else if( page != NULL && parent->type == VM_FILE )
+  {
+    if( page_needs_flush( page ) )
+      write_back( &page, 1 );
+  }
+  /* resident : share the frame. */
+  else if( page != NULL )
+  {
+    success = share_page( page, vme );
+    if( success )
+      cow_share_cnt++;
+  }
+  /* swapped out : share the slot. */
+  else if( parent->type == VM_ANON && parent->is_loaded == false
+           && parent->is_zero == false )
+    swap_dup( parent->swap_slot );
+
+  lock_release( &lru_lock );
+  fs_unlock( taken );
+
+  return success;
+}
+
+/*
+ * fault on a page that is still loaded : either shared since fork
+ * and written, or kept by an eviction that found no swap slot.
+ * copies a shared page, unless vme is the last one mapping it.
+ * returns false if out of memory.
+ */
+bool break_cow( struct vm_entry* vme )
+{
+  struct page* page;
+  struct page* copy;
+
+  lock_acquire( &lru_lock );
+
+  /* evicted meanwhile, or not shared : fault again if needed. */
+  page = vme->page;
+  if( page == NULL || vme->is_loaded == false || page->is_cow == false )
+  {
+    lock_release( &lru_lock );
+    return true;
+  }
+
+  /* nobody else left : take it over. */
+  if( list_size( &page->sharers ) == 1 )
+  {
+    page->is_cow = false;
+    pagedir_set_writable( vme->thread->pagedir, vme->vaddr, vme->writable );
+    lock_release( &lru_lock );
+    return true;
+  }
+
+  lock_release( &lru_lock );
+
+  /* may evict : not under lru_lock. */
+  copy = alloc_page( PAL_USER );
+  if( copy == NULL )
+    return false;
+
+  lock_acquire( &lru_lock );
+
+  /* evicted, or left alone while allocating : fault again. */
+  if( vme->page != page || page->is_cow == false
+      || list_size( &page->sharers ) == 1 )
+  {
+    lock_release( &lru_lock );
+    free_page( copy );
+    return true;
+  }
+
+  memcpy( copy->kaddr, page->kaddr, PGSIZE );
+  leave_page( page, vme );
+  pagedir_set_page( thread_current()->pagedir, vme->vaddr,
+                    copy->kaddr, vme->writable );
+  copy->vme = vme;
+  link_page( copy );
+  cow_copy_cnt++;
+
+  lock_release( &lru_lock );
+
+  return true;
+}
+
+/*
+ * read fault on zero page : map shared zero frame read-only.
+ */
+bool map_zero_page( struct vm_entry* vme )
+{
+  if( pagedir_set_page( thread_current()->pagedir, vme->vaddr,
+                        zero_frame, false ) == false )
+    return false;
+
+  vme->zero_mapped = true;
+  zero_map_cnt++;
+
+  return true;
+}
+
+/*
+ * write to zero page : drop zero frame, caller maps own page.
+ */
+void unmap_zero_page( struct vm_entry* vme )
+{
+  if( vme->zero_mapped )
+  {
+    pagedir_clear_page( thread_current()->pagedir, vme->vaddr );
+    vme->zero_mapped = false;
+    zero_cow_cnt++;
+  }
+}
+
+/*
+ * is page all zero?
+ */
+static bool page_is_zero( const void* kaddr )
+{
+  const uint32_t* p = kaddr;
+  size_t i;
+
+  for( i=0; i<PGSIZE / sizeof *p; i++ )
+    if( p[i] != 0 )
+      return false;
+
+  return true;
+}
+
+/*
+ * select replacement policy by name, before any page is added.
+ */
+bool vm_set_policy( const char* name )
+{
+  size_t i;
+
+  for( i=0; i<sizeof policies / sizeof *policies; i++ )
+  {
+    if( strcmp( name, policies[i].name ) == 0 )
+    {
+      policy = &policies[i];
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/*
+ * print replacement statistics.
+ */
+void vm_print_stats( void )
+{
+  printf( "Page replacement (%s): %llu evictions, %llu pages scanned, "
+          "%llu max per eviction\n",
+          policy->name, evict_cnt, scan_cnt, scan_max );
+  printf( "Page-out: %llu by daemon, %llu direct\n",
+          pageout_cnt, direct_cnt );
+  printf( "Text pages: %zu cached, %llu faults shared a cached page\n",
+          hash_size( &text_cache ), share_hit_cnt );
+  printf( "Copy-on-write: %llu pages shared by fork, %llu copied\n",
+          cow_share_cnt, cow_copy_cnt );
+  printf( "Zero pages: %llu mapped, %llu copied on write, %llu evicted\n",
+          zero_map_cnt, zero_cow_cnt, zero_evict_cnt );
+  printf( "Fault-around: %llu pages mapped, %llu read from file\n",
+          fa_cnt, fa_read_cnt );
+  printf( "Superpages: %llu mapped, %llu split, %llu faults saved\n",
+          superpage_cnt, superpage_split_cnt,
+          superpage_cnt * ( SUPERPAGE_PAGES - 1 ) );
+  printf( "Resident-set limits: %llu pages evicted by their owner\n",
+          limit_evict_cnt );
+  printf( "Mapped files: %llu pages written by flusher, %llu by msync\n",
+          flush_cnt, msync_cnt );
+  printf( "Access hints: %llu pages dropped behind scan, %llu dropped, "
+          "%llu loaded\n", drop_behind_cnt, dontneed_cnt, willneed_cnt );
+  printf( "Swap readahead: %llu pages, %llu hits, %llu misses, "
+          "window %zu\n", ra_cnt, ra_hit_cnt, ra_miss_cnt, ra_window );
+  swap_print_stats();
+}
+
+/*
+ * start page-out daemon.
+ * wakes when free user frames drop below low watermark,
+ * evicts until they are back above high watermark.
+ */
+void pageout_init( void )
+{
+  low_wmark = palloc_user_max_cnt() / 64;
+  if( low_wmark < 4 )
+    low_wmark = 4;
+  high_wmark = low_wmark * 2;
+
+  sema_init( &pageout_sema, 0 );
+  thread_create( "pageout", PRI_DEFAULT, pageout_daemon, NULL );
+}
+
+/*
+ * wake page-out daemon, unless it is already running.
+ */
+static void wake_pageout( void )
+{
+  if( pageout_awake == false )
+  {
+    pageout_awake = true;
+    sema_up( &pageout_sema );
+  }
+}
+
+/*
+ * page-out daemon main loop.
+ */
+static void pageout_daemon( void* aux UNUSED )
+{
+  for( ;; )
+  {
+    sema_down( &pageout_sema );
+
+    /* stop early if every page is pinned. */
+    while( palloc_user_free_cnt() < high_wmark )
+    {
+      if( evict_page( NULL, &pageout_cnt ) == false )
+        break;
+    }
+
+    pageout_awake = false;
+  }
+}
+
+/*
+ * start flusher, unless turned off.
+ */
+void flusher_init( void )
+{
+  if( flush_secs > 0 )
+    thread_create( "flusher", PRI_DEFAULT, flusher, NULL );
+}
+
+/*
+ * is page a resident, dirty page of a mapped file?
+ */
+static bool page_needs_flush( struct page* page )
+{
+  struct vm_entry* vme = page->vme;
+
+  return vme != NULL && vme->type == VM_FILE && vme->is_loaded
+         && page->is_readahead == false
+         && pagedir_is_dirty( page->thread->pagedir, vme->vaddr );
+}
+
+/*
+ * order by file, then offset : neighbours on disk in one pass.
+ */
+static bool flush_less( const struct page* a, const struct page* b )
+{
+  struct inode* ia = file_get_inode( a->vme->file );
+  struct inode* ib = file_get_inode( b->vme->file );
+
+  if( ia != ib )
+    return ia < ib;
+  return a->vme->offset < b->vme->offset;
+}
+
+/*
+ * write back pages[0..n), clearing dirty bits. filesys_lock and
+ * lru_lock must be held : lru_lock is dropped while writing, and
+ * the pages are pinned meanwhile.
+ */
+static void write_back( struct page** pages, size_t n )
+{
+  size_t i, j;
+
+  if( n == 0 )
+    return;
+
+  /* insertion sort : batch is small. */
+  for( i=1; i<n; i++ )
+  {
+    struct page* page = pages[i];
+
+    for( j=i; j>0 && flush_less( page, pages[j-1] ); j-- )
+      pages[j] = pages[j-1];
+    pages[j] = page;
+  }
+
+  for( i=0; i<n; i++ )
+  {
+    pagedir_set_dirty( pages[i]->thread->pagedir, pages[i]->vme->vaddr,
+                       false );
+    pages[i]->in_flush = true;
+  }
+  lock_release( &lru_lock );
+
+  for( i=0; i<n; i++ )
+  {
+    struct vm_entry* vme = pages[i]->vme;
+    file_write_at( vme->file, pages[i]->kaddr, vme->read_bytes,
+                   vme->offset );
+  }
+
+  lock_acquire( &lru_lock );
+  for( i=0; i<n; i++ )
+    pages[i]->in_flush = false;
+}
+
+/*
+ * flusher main loop : scan frame table for dirty mapped pages.
+ */
+static void flusher( void* aux UNUSED )
+{
+  for( ;; )
+  {
+    size_t i = 0;
+
+    timer_sleep( (int64_t) flush_secs * TIMER_FREQ );
+
+    /* a batch at a time : let faults and file I/O in between. */
+    while( i < init_ram_pages )
+    {
+      struct page* batch[FLUSH_BATCH];
+      size_t n = 0;
+      bool taken = fs_lock();
+
+      lock_acquire( &lru_lock );
+      for( ; i<init_ram_pages && n<FLUSH_BATCH; i++ )
+      {
+        struct page* page = &frame_table[i];
+
+        if( page->in_table && page_needs_flush( page ) )
+          batch[n++] = page;
+      }
+      write_back( batch, n );
+      flush_cnt += n;
+      lock_release( &lru_lock );
+      fs_unlock( taken );
+
+      /* waiters woken by the releases run before the next batch. */
+      thread_yield();
+    }
+  }
+}
+
+/*
+ * start working-set sampler, if turned on.
+ */
+void ws_init( void )
+{
+  if( ws_secs > 0 )
+    thread_create( "wsscan", PRI_DEFAULT, ws_sampler, NULL );
+}
+
+/*
+ * take accessed bit of page for working sets of processes mapping
+ * it. lru_lock must be held.
+ */
+static void sample_page( struct page* page )
+{
+  struct list_elem* e;
+
+  if( is_shared( page ) == false )
+  {
+    if( pagedir_is_accessed( page->thread->pagedir, page->vme->vaddr ) )
+    {
+      pagedir_set_accessed( page->thread->pagedir, page->vme->vaddr,
+                            false );
+      page->thread->ws_cnt++;
+      page->is_referenced = true;
+    }
+    return;
+  }
+
+  for( e = list_begin( &page->sharers ); e != list_end( &page->sharers );
+       e = list_next( e ) )
+  {
+    struct vm_entry* vme = list_entry( e, struct vm_entry, share_elem );
+    if( pagedir_is_accessed( vme->thread->pagedir, vme->vaddr ) )
+    {
+      pagedir_set_accessed( vme->thread->pagedir, vme->vaddr, false );
+      vme->thread->ws_cnt++;
+      page->is_referenced = true;
+    }
+  }
+}
+
+/*
+ * end of sample : pages counted become thread's working set.
+ */
+static void end_sample( struct thread* t, void* aux UNUSED )
+{
+  t->wss = t->ws_cnt;
+  t->ws_cnt = 0;
+}
+
+/*
+ * working-set sampler main loop.
+ */
+static void ws_sampler( void* aux UNUSED )
+{
+  for( ;; )
+  {
+    enum intr_level old_level;
+    size_t i;
+
+    timer_sleep( (int64_t) ws_secs * TIMER_FREQ );
+
+    lock_acquire( &lru_lock );
+    for( i=0; i<init_ram_pages; i++ )
+    {
+      struct page* page = &frame_table[i];
+
+      /* read ahead : not used by anyone yet. */
+      if( page->in_table && page->is_readahead == false )
+        sample_page( page );
+
+      /* let faults in between batches. */
+      if( i % WS_BATCH == WS_BATCH - 1 )
+      {
+        lock_release( &lru_lock );
+        thread_yield();
+        lock_acquire( &lru_lock );
+      }
+    }
+    lock_release( &lru_lock );
+
+    old_level = intr_disable();
+    thread_foreach( end_sample, NULL );
+    intr_set_level( old_level );
+  }
+}
+
+/*
+ * add pages to resident set of t.
+ */
+static void charge_rss( struct thread* t, int pages )
+{
+  enum intr_level old_level = intr_disable();
+
+  t->rss += pages;
+  if( t->rss > t->rss_peak )
+    t->rss_peak = t->rss;
+
+  intr_set_level( old_level );
+}
+
+/*
+ * msync : write back dirty pages of mapped region now.
+ */
+void vm_msync( struct vm_area* area )
+{
+  struct page* batch[FLUSH_BATCH];
+  struct list_elem* e;
+  size_t n = 0;
+  bool taken = fs_lock();
+
+  lock_acquire( &lru_lock );
+  for( e = list_begin( &area->vme_list ); e != list_end( &area->vme_list );
+       e = list_next( e ) )
+  {
+    struct page* page = list_entry( e, struct vm_entry, area_elem )->page;
+
+    if( page == NULL || page_needs_flush( page ) == false )
+      continue;
+
+    batch[n++] = page;
+    if( n == FLUSH_BATCH )
+    {
+      write_back( batch, n );
+      msync_cnt += n;
+      n = 0;
+    }
+  }
+  write_back( batch, n );
+  msync_cnt += n;
+  lock_release( &lru_lock );
+  fs_unlock( taken );
+}
+
+/*
+ * Assignment 13 : frame number of kernel address
+ */
+static size_t frame_no( void* kaddr )
+{
+  ASSERT( vtop( kaddr ) / PGSIZE < init_ram_pages );
+  return vtop( kaddr ) / PGSIZE;
+}
+
+/*
+ * Assignment 13 : find page descriptor of frame at kaddr
+ */
+struct page* find_page( void* kaddr )
+{
+  struct page* page = &frame_table[ frame_no( kaddr ) ];
+
+  return page->in_table ? page : NULL;
+}
+
+/*
+ * descriptor of frame at kaddr, just allocated by current thread.
+ */
+static struct page* frame_desc( void* kaddr )
+{
+  struct page* page = &frame_table[ frame_no( kaddr ) ];
+
+  ASSERT( page->kaddr == NULL );
+  page->kaddr = kaddr;
+  page->thread = thread_current();
+
+  return page;
+}
+
+/*
+ * Assignment 13 : adding page to list
+ */
+void add_page_to_list( struct page* page )
+{
+  enum intr_level old_level;
+
+  /* share code with other processes. */
+  if( is_text( page->vme ) )
+  {
+    lock_acquire( &lru_lock );
+    link_page( page );
+    cache_text_page( page );
+    lock_release( &lru_lock );
+    return;
+  }
+
+  /* private : policy gets it when pending pages are drained. */
+  charge_rss( page->thread, 1 );
+  old_level = intr_disable();
+  page->in_table = true;
+  page->vme->page = page;
+  page->is_pending = true;
+  list_push_back( &pending_list, &page->lru_elem );
+  intr_set_level( old_level );
+}
+
+/*
+ * hand pending pages to replacement policy. lru_lock must be held.
+ */
+static void drain_pending( void )
+{
+  for( ;; )
+  {
+    enum intr_level old_level = intr_disable();
+    struct page* page;
+
+    if( list_empty( &pending_list ) )
+    {
+      intr_set_level( old_level );
+      return;
+    }
+    page = list_entry( list_pop_front( &pending_list ),
+                       struct page, lru_elem );
+    page->is_pending = false;
+    intr_set_level( old_level );
+
+    policy->add( page );
+  }
+}
+
+/*
+ * hand page to replacement policy, register in frame table,
+ * link vme to its frame. lru_lock must be held.
+ */
+static void link_page( struct page* page )
+{
+  policy->add( page );
+  charge_rss( page->thread, 1 );
+  page->in_table = true;
+  page->vme->page = page;
+}
+
+/*
+ * Assignment 13 : deleting page from list
+ */
+void delete_page_from_list( struct page* page )
+{
+  enum intr_level old_level;
+
+  if( page->is_pending == false )
+  {
+    policy->remove( page );
+    return;
+  }
+
+  old_level = intr_disable();
+  list_remove( &page->lru_elem );
+  page->is_pending = false;
+  intr_set_level( old_level );
+}
+
+/*
+ * helpers for policies : accessed bit, pinned, hand movement.
+ */
+static bool page_accessed( struct page* page )
+{
+  struct list_elem* e;
+
+  scans++;
+
+  /* working-set sampler took the accessed bit. */
+  if( page->is_referenced )
+    return true;
+
+  if( is_shared( page ) == false )
+    return pagedir_is_accessed( page->thread->pagedir, page->vme->vaddr );
+
+  /* shared : accessed by anyone. */
+  for( e = list_begin( &page->sharers ); e != list_end( &page->sharers );
+       e = list_next( e ) )
+  {
+    struct vm_entry* vme = list_entry( e, struct vm_entry, share_elem );
+    if( pagedir_is_accessed( vme->thread->pagedir, vme->vaddr ) )
+      return true;
+  }
+  return false;
+}
+
+/*
+ * is page pinned by any process mapping it?
+ */
+static bool page_pinned( struct page* page )
+{
+  struct list_elem* e;
+
+  if( page->in_flush )
+    return true;
+  if( is_shared( page ) == false )
+    return page->vme->is_pinned;
+
+  for( e = list_begin( &page->sharers ); e != list_end( &page->sharers );
+       e = list_next( e ) )
+    if( list_entry( e, struct vm_entry, share_elem )->is_pinned )
+      return true;
+  return false;
+}
+
+static void page_clear_accessed( struct page* page )
+{
+  struct list_elem* e;
+
+  page->is_referenced = false;
+  if( is_shared( page ) == false )
+  {
+    pagedir_set_accessed( page->thread->pagedir, page->vme->vaddr, false );
+    return;
+  }
+
+  for( e = list_begin( &page->sharers ); e != list_end( &page->sharers );
+       e = list_next( e ) )
+  {
+    struct vm_entry* vme = list_entry( e, struct vm_entry, share_elem );
+    pagedir_set_accessed( vme->thread->pagedir, vme->vaddr, false );
+  }
+}
+
+static struct list_elem* clock_next( struct list_elem* e )
+{
+  e = list_next( e );
+  return e == list_end( &lru_list ) ? list_begin( &lru_list ) : e;
+}
+
+/*
+ * clock, clock2 : pages kept on lru_list.
+ */
+static void clock_add( struct page* page )
+{
+  list_push_back( &lru_list, &page->lru_elem );
+}
+
+/*
+ * clock, clock2 : if a hand points to the page, move to next.
+ */
+static void clock_remove( struct page* page )
+{
+  struct list_elem* next = list_remove( &page->lru_elem );
+
+  if( next == list_end( &lru_list ) )
+    next = list_empty( &lru_list ) ? NULL : list_begin( &lru_list );
+
+  if( lru_clock == &page->lru_elem )
+    lru_clock = next;
+  if( clock_front == &page->lru_elem )
+    clock_front = next;
+}
+
+/*
+ * clock : single hand.
+ */
+static struct page* clock_victim( void )
+{
+  struct list_elem* e;
+  struct page* page;
+  size_t i, n = list_size( &lru_list );
+
+  if( n == 0 )
+    return NULL;
+
+  /* if clock NULL, set elem to list_begin. */
+  e = ( lru_clock != NULL ) ? lru_clock : list_begin( &lru_list );
+
+  /* two rounds are enough to clear every accessed bit. */
+  for( i=0; i<2*n; i++, e = clock_next( e ) )
+  {
+    page = list_entry( e, struct page, lru_elem );
+
+    /* never evict pinned page. */
+    if( page_pinned( page ) )
+      continue;
+
+    /* if page is accessed, set to 'unaccessed'. */
+    if( page_accessed( page ) )
+    {
+      page_clear_accessed( page );
+      continue;
+    }
+
+    lru_clock = e;
+    return page;
+  }
+
+  return NULL;
+}
+
+/*
+ * clock2 : front hand clears, back hand (lru_clock) evicts.
+ */
+static struct page* clock2_victim( void )
+{
+  struct list_elem* e;
+  struct page* page;
+  size_t i, n = list_size( &lru_list );
+
+  /* one page : hands cannot be apart. */
+  if( n < 2 )
+    return clock_victim();
+
+  if( lru_clock == NULL )
+    lru_clock = list_begin( &lru_list );
+
+  /* (re)place front hand a quarter of the list ahead, but never on
+     the back hand : it would clear the bit just before the back
+     hand tests it, so no page had a second chance. */
+  if( clock_front == NULL || clock_front == lru_clock )
+  {
+    size_t spread = n/4 > 0 ? n/4 : 1;
+
+    clock_front = lru_clock;
+    for( i=0; i<spread; i++ )
+      clock_front = clock_next( clock_front );
+  }
+
+  for( i=0; i<2*n; i++ )
+  {
+    /* front hand : clear accessed bit, advance. */
+    page = list_entry( clock_front, struct page, lru_elem );
+    page_clear_accessed( page );
+    clock_front = clock_next( clock_front );
+
+    /* back hand : evict if not used since front hand passed. */
+    e = lru_clock;
+    page = list_entry( e, struct page, lru_elem );
+    lru_clock = clock_next( e );
+
+    if( page_pinned( page ) == false && page_accessed( page ) == false )
+    {
+      lru_clock = e;
+      return page;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * clockpro : new page is cold in test period, ghost comes back hot.
+ */
+static void clockpro_add( struct page* page )
+{
+  struct vm_entry* vme = page->vme;
+
+  if( vme->is_ghost )
+  {
+    /* short reuse distance : hot, and give cold pages more room. */
+    clockpro_forget( vme );
+    if( cold_target < hot_cnt + cold_cnt )
+      cold_target++;
+
+    page->is_hot = true;
+    page->in_test = false;
+    list_push_back( &hot_list, &page->lru_elem );
+    hot_cnt++;
+  }
+  else
+  {
+    page->is_hot = false;
+    page->in_test = true;
+    list_push_back( &cold_list, &page->lru_elem );
+    cold_cnt++;
+  }
+}
+
+static void clockpro_remove( struct page* page )
+{
+  list_remove( &page->lru_elem );
+
+  if( page->is_hot )
+    hot_cnt--;
+  else
+    cold_cnt--;
+}
+
+/*
+ * clockpro : drop vme from test list.
+ */
+static void clockpro_forget( struct vm_entry* vme )
+{
+  if( vme->is_ghost )
+  {
+    list_remove( &vme->ghost_elem );
+    vme->is_ghost = false;
+    ghost_cnt--;
+  }
+}
+
+/*
+ * clockpro : hot hand, demote one unaccessed hot page to cold.
+ */
+static void clockpro_run_hot( void )
+{
+  size_t i, n = hot_cnt;
+
+  for( i=0; i<2*n; i++ )
+  {
+    struct page* page = list_entry( list_pop_front( &hot_list ),
+                                    struct page, lru_elem );
+
+    if( page_accessed( page ) || page_pinned( page ) )
+    {
+      page_clear_accessed( page );
+      list_push_back( &hot_list, &page->lru_elem );
+      continue;
+    }
+
+    page->is_hot = false;
+    page->in_test = false;
+    list_push_back( &cold_list, &page->lru_elem );
+    hot_cnt--;
+    cold_cnt++;
+    return;
+  }
+}
+
+/*
+ * clockpro : cold hand.
+ */
+static struct page* clockpro_victim( void )
+{
+  size_t i, n = hot_cnt + cold_cnt;
+
+  if( n == 0 )
+    return NULL;
+
+  for( i=0; i<2*n; i++ )
+  {
+    struct page* page;
+
+    /* keep hot pages within their share, and some cold page. */
+    if( cold_cnt == 0 || hot_cnt + cold_target > n )
+    {
+      if( hot_cnt > 0 )
+        clockpro_run_hot();
+      if( cold_cnt == 0 )
+        continue;
+    }
+
+    page = list_entry( list_pop_front( &cold_list ), struct page, lru_elem );
+
+    if( page_pinned( page ) )
+    {
+      list_push_back( &cold_list, &page->lru_elem );
+      continue;
+    }
+
+    if( page_accessed( page ) )
+    {
+      page_clear_accessed( page );
+
+      /* referenced in test period : promote to hot. */
+      if( page->in_test )
+      {
+        page->is_hot = true;
+        page->in_test = false;
+        list_push_back( &hot_list, &page->lru_elem );
+        cold_cnt--;
+        hot_cnt++;
+      }
+      else
+      {
+        page->in_test = true;
+        list_push_back( &cold_list, &page->lru_elem );
+      }
+      continue;
+    }
+
+    /* victim : put back so that remove() finds it on the list. */
+    list_push_front( &cold_list, &page->lru_elem );
+
+    /* remember it while in test period. */
+    if( page->in_test )
+    {
+      list_push_back( &ghost_list, &page->vme->ghost_elem );
+      page->vme->is_ghost = true;
+      ghost_cnt++;
+
+      /* expire oldest ghost : cold pages get less room. */
+      if( ghost_cnt > n )
+      {
+        struct vm_entry* old = list_entry( list_front( &ghost_list ),
+                                           struct vm_entry, ghost_elem );
+        clockpro_forget( old );
+        if( cold_target > 1 )
+          cold_target--;
+      }
+    }
+
+    return page;
+  }
+
+  return NULL;
+}
+
+/*
+ * Assignment 13 : allocating page
+ * WARNING - member 'vme' and 'lru_elem' should be handled
+ *           out of this page.
+ */
+struct page* alloc_page( enum palloc_flags flag )
+{
+  struct thread* t = thread_current();
+  void* kaddr;
+  int tries;
+
+  /* at resident-set limit : make room among own pages first. */
+  if( t->rss_limit != 0 && t->rss >= t->rss_limit )
+    evict_page( t, &limit_evict_cnt );
+
+  /* allocate kernel memory. */
+  /* if no more, try to free a page. */
+  /* give up if nothing can be evicted for a while : swap is full. */
+  kaddr = palloc_get_page( flag );
+  for( tries=0; kaddr == NULL; tries++ )
+  {
+    if( tries == ALLOC_TRIES )
+      return NULL;
+    kaddr = try_to_get_page( flag );
+  }
+
+  /* running low : let page-out daemon refill in background. */
+  if( palloc_user_free_cnt() < low_wmark )
+    wake_pageout();
+
+  return frame_desc( kaddr );
+}
+
+/*
+ * Assignment 13 : try to free victim, and get page.
+ * direct reclaim : page-out daemon did not keep up.
+ */
+static void* try_to_get_page( enum palloc_flags flag )
+{
+  wake_pageout();
+
+  /* every page pinned : nothing to evict now. */
+  if( evict_page( NULL, &direct_cnt ) == false )
+    thread_yield();
+
+  return palloc_get_page( flag );
+}
+
+/*
+ * order victims by owner, then by address : pages of one
+ * process end up side by side, virtually adjacent ones in order.
+ */
+static bool victim_less( const struct page* a, const struct page* b )
+{
+  if( a->thread != b->thread )
+    return a->thread < b->thread;
+  return a->vme->vaddr < b->vme->vaddr;
+}
+
+static void sort_victims( struct page** victims, size_t n )
+{
+  size_t i, j;
+
+  /* insertion sort : batch is small. */
+  for( i=1; i<n; i++ )
+  {
+    struct page* page = victims[i];
+
+    for( j=i; j>0 && victim_less( page, victims[j-1] ); j-- )
+      victims[j] = victims[j-1];
+    victims[j] = page;
+  }
+}
+
+/*
+ * does victim go to swap? executable pages do, after conversion.
+ */
+static bool goes_to_swap( struct page* page )
+{
+  struct vm_entry* vme = page->vme;
+
+  /* read-only executable pages are just read again. */
+  return ( ( vme->type == VM_BIN && vme->writable ) || vme->type == VM_ANON )
+         && vme->is_zero == false;
+}
+
+/*
+ * write victims[i..] of one process that go to swap to
+ * consecutive swap slots. returns index after the run.
+ * pages that found no slot are marked in kept[].
+ */
+static size_t swap_out_run( struct page** victims, bool* kept,
+                            size_t i, size_t n )
+{
+  void* kaddrs[EVICT_BATCH];
+  size_t j, cnt, slot;
+
+  for( j=i; j<n; j++ )
+  {
+    if( goes_to_swap( victims[j] ) == false
+        || victims[j]->is_readahead
+        || victims[j]->thread != victims[i]->thread )
+      break;
+    kaddrs[j-i] = victims[j]->kaddr;
+  }
+  cnt = j - i;
+
+  /* no run of free slots that long : one by one. */
+  slot = swap_out_cluster( kaddrs, cnt );
+  for( j=0; j<cnt; j++ )
+  {
+    size_t swap_slot = ( slot != BITMAP_ERROR ) ? slot + j
+                                                : swap_out( kaddrs[j] );
+
+    /* swap is full : page stays. */
+    if( swap_slot == BITMAP_ERROR )
+    {
+      kept[i+j] = true;
+      continue;
+    }
+
+    set_anon( victims[i+j], swap_slot, false );
+  }
+
+  return i + cnt;
+}
+
+/*
+ * victim among private pages of owner : first one not used since
+ * the hand last passed it. the hand moves at most *budget frames,
+ * taken from it. NULL if owner has none to give up.
+ * lru_lock must be held.
+ */
+static struct page* own_victim( struct thread* owner, size_t* budget )
+{
+  while( *budget > 0 )
+  {
+    struct page* page = &frame_table[ own_hand ];
+
+    own_hand = ( own_hand + 1 ) % init_ram_pages;
+    (*budget)--;
+    if( page->in_table == false || page->thread != owner
+        || page->is_victim || is_shared( page ) || page_pinned( page ) )
+      continue;
+
+    if( page_accessed( page ) )
+    {
+      page_clear_accessed( page );
+      continue;
+    }
+    return page;
+  }
+
+  return NULL;
+}
+
+/*
+ * Assignment 13 : evict a batch of victim pages, counting them in *cnt.
+ * only pages of owner, if it is not NULL.
+ * returns false if no page could be evicted.
+ */
+static bool evict_page( struct thread* owner, unsigned long long* cnt )
+{
+  struct page* victims[EVICT_BATCH];
+  bool is_dirty[EVICT_BATCH];
+  bool kept[EVICT_BATCH];
+  struct page* flush[EVICT_BATCH];
+  struct vm_entry* flush_vmes[EVICT_BATCH];
+  size_t n, i, evicted, flush_n = 0;
+  size_t budget = init_ram_pages;   /* own_victim() : one lap per batch */
+
+  lock_acquire( &lru_lock );
+
+  /* gather victims. take them off the lists and out of their
+     page directories, so owners cannot change them while being
+     written : a fault on them waits for lru_lock. */
+  for( n=0, i=0; i<EVICT_BATCH; i++ )
+  {
+    struct page* victim = owner != NULL ? own_victim( owner, &budget )
+                                        : get_victim_page();
+    if( victim == NULL )
+      break;
+
+    /* dirty mapped file : written below, without lru_lock, and
+       evicted clean next time. pinned meanwhile. */
+    if( page_needs_flush( victim ) )
+    {
+      victim->in_flush = true;
+      flush[flush_n] = victim;
+      flush_vmes[flush_n++] = victim->vme;
+      continue;
+    }
+
+    delete_page_from_list( victim );
+    victim->is_victim = true;
+    victims[n++] = victim;
+
+    /* read ahead for nothing : shrink window. */
+    if( victim->is_readahead )
+    {
+      ra_miss_cnt++;
+      ra_window = ra_window > 1 ? ra_window / 2 : 1;
+    }
+  }
+
+  if( n == 0 )
+  {
+    lock_release( &lru_lock );
+    flush_victims( flush, flush_vmes, flush_n );
+    return flush_n > 0;
+  }
+
+  /* neighbours next to each other. */
+  sort_victims( victims, n );
+
+  /* get if page is dirty, unmap. */
+  for( i=0; i<n; i++ )
+  {
+    struct page* victim = victims[i];
+    is_dirty[i] = pagedir_is_dirty( victim->thread->pagedir,
+                                    victim->vme->vaddr );
+    kept[i] = false;
+    unmap_page( victim );
+
+    /* all zero : remember that instead of swapping. */
+    if( goes_to_swap( victim ) && victim->is_readahead == false
+        && page_is_zero( victim->kaddr ) )
+    {
+      set_anon( victim, 0, true );
+      zero_evict_cnt++;
+    }
+  }
+
+  /* write back by vme type */
+  for( i=0; i<n; )
+  {
+    struct page* victim = victims[i];
+
+    /* read ahead : still in its swap slot, just drop it.
+       zero : nothing to write. */
+    if( victim->is_readahead || victim->vme->is_zero )
+    {
+      i++;
+      continue;
+    }
+
+    /* VM_BIN : never write back to executable, swap it instead.
+       VM_ANON : always set swap slot. */
+    if( goes_to_swap( victim ) )
+    {
+      i = swap_out_run( victims, kept, i, n );
+      continue;
+    }
+
+    /* VM_FILE : written to since gathered, so not written here,
+       under lru_lock : keep it, flusher or next eviction writes it.
+       read-only VM_BIN : nothing to write. */
+    if( victim->vme->type == VM_FILE && is_dirty[i] == true )
+      kept[i] = true;
+    i++;
+  }
+
+  /* unloaded from now on. */
+  evicted = 0;
+  for( i=0; i<n; i++ )
+  {
+    struct page* victim = victims[i];
+
+    /* no swap slot : map it again, back on the lists. */
+    if( kept[i] )
+    {
+      remap_page( victim );
+      pagedir_set_dirty( victim->thread->pagedir, victim->vme->vaddr,
+                         is_dirty[i] );
+      victim->is_victim = false;
+      policy->add( victim );
+      continue;
+    }
+
+    if( is_shared( victim ) )
+    {
+      struct list_elem* e;
+
+      for( e = list_begin( &victim->sharers );
+           e != list_end( &victim->sharers ); e = list_next( e ) )
+        list_entry( e, struct vm_entry, share_elem )->is_loaded = false;
+    }
+    victim->vme->is_loaded = false;
+    release_frame( victim );
+    evicted++;
+  }
+  (*cnt) += evicted;
+
+  lock_release( &lru_lock );
+
+  flush_victims( flush, flush_vmes, flush_n );
+
+  return evicted > 0 || flush_n > 0;
+}
+
+/*
+ * write back dirty mapped file pages[0..n) the evictor left pinned,
+ * under filesys_lock, as the flusher does. a page freed meanwhile,
+ * by munmap or exit, has lost its in_flush mark and is skipped.
+ * no lock may be held but filesys_lock.
+ */
+static void flush_victims( struct page** pages, struct vm_entry** vmes,
+                           size_t n )
+{
+  struct page* batch[EVICT_BATCH];
+  size_t i, cnt = 0;
+  bool taken;
+
+  if( n == 0 )
+    return;
+
+  taken = fs_lock();
+  lock_acquire( &lru_lock );
+  for( i=0; i<n; i++ )
+  {
+    if( pages[i]->in_flush && pages[i]->vme == vmes[i]
+        && page_needs_flush( pages[i] ) )
+      batch[cnt++] = pages[i];
+    pages[i]->in_flush = false;
+  }
+  write_back( batch, cnt );
+  lock_release( &lru_lock );
+  fs_unlock( taken );
+}
+
+/*
+ * Assignment 13 : wait while vme's page is being evicted
+ * returns true if it was kept after all, mapped again.
+ */
+bool wait_for_eviction( struct vm_entry* vme )
+{
+  bool kept = false;
+
+  /* still loaded but faulted : evictor holds lru_lock. */
+  if( vme->is_loaded )
+  {
+    lock_acquire( &lru_lock );
+    kept = vme->is_loaded;
+    lock_release( &lru_lock );
+  }
+
+  return kept;
+}
+
+/*
+ * fault on a page read ahead : map it, release its swap slot.
+ * returns false if vme has no such page.
+ */
+bool map_readahead_page( struct vm_entry* vme )
+{
+  struct page* page;
+  bool success = false;
+
+  lock_acquire( &lru_lock );
+
+  page = vme->page;
+  if( page != NULL && page->is_readahead )
+  {
+    if( pagedir_set_page( page->thread->pagedir, vme->vaddr,
+                          page->kaddr, vme->writable ) )
+    {
+      page->is_readahead = false;
+      vme->is_loaded = true;
+      swap_free( vme->swap_slot );
+
+      /* readahead paid off : widen window. */
+      ra_hit_cnt++;
+      if( ra_window < RA_MAX )
+        ra_window++;
+
+      success = true;
+    }
+  }
+
+  lock_release( &lru_lock );
+
+  return success;
+}
+
+/*
+ * after swap fault on vme, read following pages of the current
+ * process that were swapped out right after it.
+ * only uses free frames : readahead never evicts.
+ */
+void swap_readahead( struct vm_entry* vme )
+{
+  size_t i, window = ra_window;
+
+  /* access hint overrides what readahead learned. */
+  if( vme->area != NULL && vme->area->advice == MADV_RANDOM )
+    return;
+  if( vme->area != NULL && vme->area->advice == MADV_SEQUENTIAL )
+    window = RA_MAX;
+
+  for( i=1; i<=window; i++ )
+  {
+    struct vm_entry* next;
+    struct page* page;
+    void* kaddr;
+
+    /* neighbour must be swapped out to the neighbouring slot. */
+    next = lookup_vme( vme->vaddr + i * PGSIZE );
+    if( next == NULL || next->type != VM_ANON || next->is_loaded
+        || next->is_zero || next->page != NULL || next->swap_slot != vme->swap_slot + i )
+      break;
+
+    /* leave low free frames to real faults. */
+    if( palloc_user_free_cnt() <= low_wmark )
+      break;
+    kaddr = palloc_get_page( PAL_USER );
+    if( kaddr == NULL )
+      break;
+
+    page = frame_desc( kaddr );
+    page->vme = next;
+    page->is_readahead = true;
+
+    swap_read( next->swap_slot, kaddr );
+    add_page_to_list( page );
+    ra_cnt++;
+  }
+}
+
+/*
+ * can block of superpage at start in area be mapped at once?
+ * every page of it must be zero-fill, not loaded and not pinned.
+ */
+static bool superpage_fits( struct vm_area* area, uint8_t* start )
+{
+  uint8_t* vaddr;
+
+  if( area == NULL || area->writable == false
+      || ( area->type != VM_ANON && area->type != VM_BIN )
+      || start < area->start + ROUND_UP( area->read_bytes, PGSIZE )
+      || start + PTSPAN > area->end )
+    return false;
+
+  /* frames must be left for everything else. */
+  if( palloc_user_free_cnt() < SUPERPAGE_PAGES + low_wmark )
+    return false;
+
+  for( vaddr = start; vaddr < start + PTSPAN; vaddr += PGSIZE )
+  {
+    struct vm_entry* vme = lookup_vme( vaddr );
+    if( vme != NULL && ( vme->is_zero == false || vme->is_loaded
+                         || vme->page != NULL || vme->is_pinned ) )
+      return false;
+  }
+  return true;
+}
+
+/*
+ * write fault on zero page : map its whole 4 MB block at once.
+ * vmes of the block, vme too, are freed : the superpage stands
+ * for all of them until it is split.
+ * returns false if the block does not qualify, or memory is
+ * short : caller maps just the page.
+ */
+bool map_superpage( struct vm_entry* vme )
+{
+  struct thread* t = thread_current();
+  struct vm_area* area = vme->area;
+  uint8_t* start = (uint8_t*)( (uintptr_t) vme->vaddr & ~(PTSPAN - 1) );
+  struct superpage* sp;
+  uint8_t* vaddr;
+
+  if( superpage_enabled == false || init_pse == false
+      || superpage_fits( area, start ) == false )
+    return false;
+
+  sp = (struct superpage*) malloc (sizeof(struct superpage));
+  if( sp == NULL )
+    return false;
+
+  /* contiguous frames, as aligned as the block. */
+  sp->kaddr = palloc_get_aligned( PAL_USER | PAL_ZERO, SUPERPAGE_PAGES );
+  if( sp->kaddr == NULL )
+  {
+    free( sp );
+    return false;
+  }
+
+  /* zero frame mappings are faulted in again if this fails. */
+  for( vaddr = start; vaddr < start + PTSPAN; vaddr += PGSIZE )
+  {
+    struct vm_entry* v = lookup_vme( vaddr );
+    if( v != NULL && v->zero_mapped )
+    {
+      pagedir_clear_page( t->pagedir, v->vaddr );
+      v->zero_mapped = false;
+    }
+  }
+
+  if( pagedir_set_large_page( t->pagedir, start, sp->kaddr,
+                              area->writable ) == false )
+  {
+    palloc_free_multiple( sp->kaddr, SUPERPAGE_PAGES );
+    free( sp );
+    return false;
+  }
+
+  for( vaddr = start; vaddr < start + PTSPAN; vaddr += PGSIZE )
+  {
+    struct vm_entry* v = lookup_vme( vaddr );
+    if( v == NULL )
+      continue;
+
+    /* only zero-fill left : off CLOCK-Pro test list, and gone. */
+    free_vme_page( v );
+    list_remove( &v->area_elem );
+    delete_vme( &t->vm, v );
+    free( v );
+  }
+
+  sp->start = start;
+  sp->area = area;
+  list_push_back( &area->superpages, &sp->elem );
+  charge_rss( t, SUPERPAGE_PAGES );
+  superpage_cnt++;
+
+  /* running low : let page-out daemon refill in background. */
+  if( palloc_user_free_cnt() < low_wmark )
+    wake_pageout();
+
+  return true;
+}
+
+/*
+ * superpage of area holding vaddr, or NULL.
+ */
+static struct superpage* find_superpage( struct vm_area* area,
+                                         const void* vaddr )
+{
+  struct list_elem* e;
+
+  if( area == NULL )
+    return NULL;
+
+  for( e = list_begin( &area->superpages ); e != list_end( &area->superpages );
+       e = list_next( e ) )
+  {
+    struct superpage* sp = list_entry( e, struct superpage, elem );
+
+    if( sp->start <= (const uint8_t*)vaddr
+        && (const uint8_t*)vaddr < sp->start + PTSPAN )
+      return sp;
+  }
+  return NULL;
+}
+
+/*
+ * give every page of superpage its vme and page, as if each had
+ * been faulted in : they are evicted, shared and dropped one by
+ * one from now on. sp is freed.
+ * returns false if out of memory : then nothing has changed.
+ */
+static bool split_superpage( struct superpage* sp )
+{
+  struct thread* t = thread_current();
+  uint8_t* vaddr;
+  size_t i;
+
+  for( vaddr = sp->start; vaddr < sp->start + PTSPAN; vaddr += PGSIZE )
+  {
+    if( make_area_vme( sp->area, vaddr ) != NULL )
+      continue;
+
+    /* undo the ones made. */
+    while( vaddr > sp->start )
+    {
+      struct vm_entry* vme;
+
+      vaddr -= PGSIZE;
+      vme = lookup_vme( vaddr );
+      list_remove( &vme->area_elem );
+      delete_vme( &t->vm, vme );
+      free( vme );
+    }
+    return false;
+  }
+
+  /* link_page() charges every page again. */
+  charge_rss( t, -SUPERPAGE_PAGES );
+
+  lock_acquire( &lru_lock );
+  for( i=0; i<SUPERPAGE_PAGES; i++ )
+  {
+    struct page* page = frame_desc( sp->kaddr + i * PGSIZE );
+
+    page->vme = lookup_vme( sp->start + i * PGSIZE );
+    page->vme->is_zero = false;
+    page->vme->is_loaded = true;
+    link_page( page );
+  }
+  lock_release( &lru_lock );
+
+  list_remove( &sp->elem );
+  free( sp );
+  superpage_split_cnt++;
+
+  return true;
+}
+
+/*
+ * unmap superpage and free its frames. sp is freed.
+ */
+static void release_superpage( struct superpage* sp )
+{
+  struct thread* t = thread_current();
+
+  pagedir_clear_large_page( t->pagedir, sp->start );
+  palloc_free_multiple( sp->kaddr, SUPERPAGE_PAGES );
+  charge_rss( t, -SUPERPAGE_PAGES );
+
+  list_remove( &sp->elem );
+  free( sp );
+}
+
+/*
+ * split every superpage of current process : fork copies vmes.
+ * returns false if out of memory.
+ */
+bool split_superpages( void )
+{
+  struct thread* t = thread_current();
+  size_t i;
+
+  for( i=0; i<t->area_cnt; i++ )
+  {
+    struct vm_area* area = t->areas[i];
+
+    while( list_empty( &area->superpages ) == false )
+      if( split_superpage( list_entry( list_front( &area->superpages ),
+                                       struct superpage, elem ) ) == false )
+        return false;
+  }
+  return true;
+}
+
+/*
+ * after fault on file-backed vme, map neighbours in its window.
+ */
+void fault_around( struct vm_entry* vme )
+{
+  struct vm_area* area = vme->area;
+  size_t window = fault_around_pages * PGSIZE;
+  uint8_t *start, *end, *vaddr;
+
+  if( area == NULL || window == 0 || area->advice == MADV_RANDOM )
+    return;
+
+  /* sequential : further ahead only, drop what is behind.
+     else : aligned window around fault. */
+  if( area->advice == MADV_SEQUENTIAL )
+  {
+    window *= SEQ_FACTOR;
+    start = vme->vaddr;
+    if( (size_t)( start - area->start ) >= 2 * window )
+      drop_behind( start - 2 * window, start - window );
+  }
+  else
+    start = (uint8_t*)vme->vaddr - (uintptr_t)vme->vaddr % window;
+  end = start + window;
+  if( start < area->start )
+    start = area->start;
+  if( end > area->end )
+    end = area->end;
+
+  for( vaddr = start; vaddr < end; vaddr += PGSIZE )
+  {
+    struct vm_entry* next;
+    struct page* page;
+    void* kaddr;
+
+    if( vaddr == vme->vaddr )
+      continue;
+
+    /* already there, or in swap. */
+    next = lookup_vme( vaddr );
+    if( next != NULL && ( next->is_loaded || next->zero_mapped
+                          || next->page != NULL || next->type == VM_ANON ) )
+      continue;
+
+    if( next == NULL )
+      next = make_area_vme( area, vaddr );
+    if( next == NULL )
+      break;
+
+    /* free to map : zero frame, or code already in memory. */
+    if( next->is_zero ? map_zero_page( next ) : map_shared_page( next ) )
+    {
+      fa_cnt++;
+      continue;
+    }
+    if( next->is_zero )
+      continue;
+
+    /* leave low free frames to real faults. */
+    if( palloc_user_free_cnt() <= low_wmark )
+      continue;
+    kaddr = palloc_get_page( PAL_USER );
+    if( kaddr == NULL )
+      continue;
+
+    if( load_file( kaddr, next ) == false
+        || pagedir_set_page( thread_current()->pagedir, vaddr,
+                             kaddr, next->writable ) == false )
+    {
+      palloc_free_page( kaddr );
+      continue;
+    }
+    page = frame_desc( kaddr );
+    page->vme = next;
+
+    next->is_loaded = true;
+    add_page_to_list( page );
+    fa_cnt++;
+    fa_read_cnt++;
+  }
+}
+
+/*
+ * Pinning : pages of a user buffer that a system call reads or
+ * writes are loaded and pinned beforehand, so the file system
+ * never faults on them while holding its lock, and the evictor
+ * leaves them alone until they are unpinned.
+ */
+
+/*
+ * load and pin pages of [addr, addr + size). pages to be written
+ * also get a frame of their own. returns false if a page is not
+ * mapped or cannot be loaded : then none is left pinned.
+ */
+bool vm_pin( void* addr, size_t size, bool write )
+{
+  uint8_t* start = pg_round_down( addr );
+  uint8_t* end = (uint8_t*)addr + size;
+  uint8_t* vaddr;
+
+  for( vaddr = start; vaddr < end; vaddr += PGSIZE )
+  {
+    struct vm_entry* vme = find_vme( vaddr );
+    bool loaded;
+
+    if( vme == NULL )
+      break;
+
+    /* pin first : once loaded, it stays. */
+    vme->is_pinned = true;
+    loaded = wait_for_eviction( vme );
+
+    /* not in memory, or to be written but shared since fork :
+       fault it now. shared zero frame is fine for reading. */
+    if( ( loaded == false && ( write || vme->zero_mapped == false ) )
+        || ( loaded && write && vme->page->is_cow ) )
+    {
+      if( handle_mm_fault( vme ) == false )
+      {
+        vme->is_pinned = false;
+        break;
+      }
+    }
+  }
+
+  if( vaddr < end )
+  {
+    vm_unpin( start, vaddr - start );
+    return false;
+  }
+  return true;
+}
+
+/*
+ * unpin pages of [addr, addr + size).
+ */
+void vm_unpin( void* addr, size_t size )
+{
+  uint8_t* end = (uint8_t*)addr + size;
+  uint8_t* vaddr;
+
+  for( vaddr = pg_round_down( addr ); vaddr < end; vaddr += PGSIZE )
+  {
+    struct vm_entry* vme = lookup_vme( vaddr );
+    if( vme != NULL )
+      vme->is_pinned = false;
+  }
+}
+
+/*
+ * give up frame of vme now, writing it back if it is mapped file.
+ * returns false if pinned.
+ */
+static bool drop_page( struct vm_entry* vme )
+{
+  bool taken;
+
+  if( vme->is_pinned )
+    return false;
+
+  /* mapped file : write from its frame, as msync. */
+  taken = fs_lock();
+  lock_acquire( &lru_lock );
+  if( vme->type == VM_FILE && vme->page != NULL
+      && page_needs_flush( vme->page ) )
+  {
+    struct page* page = vme->page;
+    write_back( &page, 1 );
+  }
+  lock_release( &lru_lock );
+
+  free_vme_page( vme );
+  vme->is_loaded = false;
+  fs_unlock( taken );
+
+  return true;
+}
+
+/*
+ * sequential scan passed [start, end) : drop pages there that can
+ * be read again from their file.
+ */
+static void drop_behind( uint8_t* start, uint8_t* end )
+{
+  uint8_t* vaddr;
+
+  for( vaddr = start; vaddr < end; vaddr += PGSIZE )
+  {
+    struct vm_entry* vme = lookup_vme( vaddr );
+
+    if( vme != NULL && vme->is_loaded
+        && ( vme->type == VM_FILE || is_text( vme ) )
+        && drop_page( vme ) )
+      drop_behind_cnt++;
+  }
+}
+
+/*
+ * DONTNEED : forget contents of vme. pages of a region are read
+ * again from their file, others come back zero.
+ */
+static void dontneed_vme( struct vm_entry* vme )
+{
+  if( vme->is_loaded == false && vme->page == NULL
+      && ( vme->type != VM_ANON || vme->is_zero ) )
+    return;
+
+  /* mapped file : keep what was written. */
+  if( vme->type == VM_FILE )
+  {
+    if( drop_page( vme ) )
+      dontneed_cnt++;
+    return;
+  }
+
+  if( vme->is_pinned )
+    return;
+
+  /* frame, or swap slot, goes with it. */
+  free_vme_page( vme );
+  dontneed_cnt++;
+
+  /* made again from region when touched. */
+  if( vme->area != NULL )
+  {
+    list_remove( &vme->area_elem );
+    delete_vme( &thread_current()->vm, vme );
+    free( vme );
+    return;
+  }
+
+  vme->type = VM_ANON;
+  vme->is_loaded = false;
+  vme->is_zero = true;
+}
+
+/*
+ * apply access hint to pages [addr, addr + length).
+ * returns false if advice is unknown.
+ */
+bool vm_advise( void* addr, size_t length, int advice )
+{
+  struct thread* t = thread_current();
+  uint8_t* start = pg_round_down( addr );
+  uint8_t* end = (uint8_t*)addr + length;
+  uint8_t* vaddr;
+  size_t i;
+
+  switch( advice )
+  {
+    case MADV_NORMAL:
+    case MADV_RANDOM:
+    case MADV_SEQUENTIAL:
+      /* whole regions overlapping range. */
+      for( i = area_index( t, start );
+           i < t->area_cnt && t->areas[i]->start < end; i++ )
+        t->areas[i]->advice = advice;
+      return true;
+
+    case MADV_WILLNEED:
+      /* load now, without going below low watermark. */
+      for( vaddr = start; vaddr < end; vaddr += PGSIZE )
+      {
+        struct superpage* sp = find_superpage( find_area( vaddr ), vaddr );
+        struct vm_entry* vme;
+
+        /* superpage : all in memory already. */
+        if( sp != NULL )
+        {
+          vaddr = sp->start + PTSPAN - PGSIZE;
+          continue;
+        }
+
+        vme = find_vme( vaddr );
+        if( vme == NULL || vme->is_loaded || vme->zero_mapped
+            || vme->is_zero )
+          continue;
+        if( palloc_user_free_cnt() <= low_wmark
+            || handle_mm_fault( vme ) == false )
+          break;
+        willneed_cnt++;
+      }
+      return true;
+
+    case MADV_DONTNEED:
+      for( vaddr = start; vaddr < end; vaddr += PGSIZE )
+      {
+        struct superpage* sp = find_superpage( find_area( vaddr ), vaddr );
+        struct vm_entry* vme;
+
+        /* superpage : whole of it goes at once, part of it is
+           split first. */
+        if( sp != NULL )
+        {
+          uint8_t* last = sp->start + PTSPAN - PGSIZE;
+
+          if( sp->start >= start && last < end )
+          {
+            release_superpage( sp );
+            dontneed_cnt += SUPERPAGE_PAGES;
+            vaddr = last;
+            continue;
+          }
+          if( split_superpage( sp ) == false )
+          {
+            vaddr = last;
+            continue;
+          }
+        }
+
+        vme = lookup_vme( vaddr );
+        if( vme != NULL )
+          dontneed_vme( vme );
+      }
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+/*
+ * Assignment 13 : getting victim page from policy
+ */
+static struct page* get_victim_page()
+{
+  struct page* page;
+
+  /* pages loaded since last time are candidates too. */
+  drain_pending();
+
+  scans = 0;
+  page = policy->victim();
+
+  /* update statistics. */
+  scan_cnt += scans;
+  if( scans > scan_max )
+    scan_max = scans;
+  if( page != NULL )
+    evict_cnt++;
+
+  return page;
+}
+
+/*
+ * Assignment 13 : free page for outside of this source
+ */
+void free_page( struct page* page )
+{
+  lock_acquire( &lru_lock );
+  __free_page( page );
+  lock_release( &lru_lock );
+}
+
+/*
+ * Assignment 13 : free the frame holding vme, if it is loaded
+ */
+void free_vme_page( struct vm_entry* vme )
+{
+  lock_acquire( &lru_lock );
+
+  if( vme->page != NULL && is_shared( vme->page ) )
+  {
+    struct page* page = vme->page;
+
+    /* shared : leave, the last one out frees it. */
+    if( leave_page( page, vme ) )
+      __free_page( page );
+  }
+  else if( vme->page != NULL )
+  {
+    /* read ahead, never mapped : still holds its swap slot. */
+    if( vme->page->is_readahead )
+      swap_free( vme->swap_slot );
+
+    __free_page( vme->page );
+  }
+  /* swapped out : give back its slot. */
+  else if( vme->type == VM_ANON && vme->is_loaded == false
+           && vme->is_zero == false )
+    swap_free( vme->swap_slot );
+
+  /* unmap zero frame : pagedir_destroy() must not free it. */
+  if( vme->zero_mapped )
+  {
+    pagedir_clear_page( thread_current()->pagedir, vme->vaddr );
+    vme->zero_mapped = false;
+  }
+
+  /* vme is going away : must not stay on test list. */
+  clockpro_forget( vme );
+
+  lock_release( &lru_lock );
+}
+
+/*
+ * Assignment 13 : free page descriptor, delete page entry
+ */
+static void __free_page( struct page* page )
+{
+  /* a page without vme was never added to list or frame table. */
+  if( page->vme != NULL )
+  {
+    /* delete from list */
+    delete_page_from_list( page );
+  }
+
+  release_frame( page );
+}
+
+/*
+ * Assignment 13 : free frame and descriptor of page off the list
+ */
+static void release_frame( struct page* page )
+{
+  void* kaddr;
+
+  if( page->vme != NULL )
+  {
+    /* delete entry of page directory. */
+    unmap_page( page );
+
+    /* unlink vme. */
+    page->vme->page = NULL;
+
+    /* leave text cache, unlink all sharers. */
+    if( page->in_cache )
+      hash_delete( &text_cache, &page->cache_elem );
+    if( is_shared( page ) )
+    {
+      struct list_elem* e;
+
+      for( e = list_begin( &page->sharers ); e != list_end( &page->sharers );
+           e = list_next( e ) )
+      {
+        struct vm_entry* vme = list_entry( e, struct vm_entry, share_elem );
+        vme->page = NULL;
+        charge_rss( vme->thread, -1 );
+      }
+    }
+    else
+      charge_rss( page->thread, -1 );
+  }
+
+  /* clear descriptor before the frame can be allocated again. */
+  kaddr = page->kaddr;
+  memset( page, 0, sizeof(struct page) );
 
-  /* deallocate page descriptor. */
-  free( page );
+  /* deallocate page from kernel. */
+  palloc_free_page( kaddr );
 }
 
 
@@ -1,12 +1,15 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
 #include <kernel/hash.h>
 #include <kernel/list.h>
 #include "threads/palloc.h"
 #include "threads/thread.h"
+#include "devices/block.h"
 
 #define VM_BIN 0
 #define VM_FILE 1
 #define VM_ANON 2
-#define STACK_HEURISTIC 3
 
 /*
  * Assignment 11 : virtual memory
@@ -23,13 +26,44 @@ struct vm_entry
   size_t zero_bytes;                 /* zero bytes */
 
   struct hash_elem elem;             /* element for thread's vm table */
-  struct list_elem mmap_elem;        /* element for mmap_file */
+  struct list_elem area_elem;        /* element for vm_area's vme_list */
+  struct vm_area *area;              /* region made from, or NULL */
 
   size_t swap_slot;                  /* slot number saved for 'swap' */
   bool is_pinned;                    /* if pinned, don't swap this. */
+
+  struct page *page;                 /* frame holding this page, or NULL */
+
+  struct list_elem ghost_elem;       /* element for CLOCK-Pro test list */
+  bool is_ghost;                     /* on CLOCK-Pro test list? */
+
+  bool is_zero;                      /* all zero : nothing to load */
+  bool zero_mapped;                  /* mapped to shared zero frame */
+
+  struct list_elem share_elem;       /* element for page's sharers */
+  struct thread* thread;             /* owner, while sharing a page */
 };
 
 
+/*
+ * Region of address space : an executable segment or a mapped file.
+ * vm_entry of each of its pages is made when the page is first
+ * touched, so mapping a large region costs the same as a small one.
+ */
+struct vm_area
+{
+  uint8_t type;                      /* VM_BIN, VM_FILE, VM_ANON : stack */
+  uint8_t *start;                    /* first page */
+  uint8_t *end;                      /* one past last page */
+  bool writable;                     /* flag for writability */
+  struct file *file;                 /* file mapped to region */
+  size_t offset;                     /* offset for file at start */
+  size_t read_bytes;                 /* bytes read from file, rest zero */
+  struct list vme_list;              /* vm_entries made so far */
+  struct list superpages;            /* 4 MB blocks not split yet */
+  uint8_t advice;                    /* MADV_*, from madvise() */
+};
+
 /*
  * Assignment 11 : virtual memory
  */
@@ -40,6 +74,17 @@ struct vm_entry* find_vme( void *vaddr );
 void vm_destroy( struct hash *vm );
 bool load_file( void *kaddr, struct vm_entry *vme );
 
+/*
+ * Regions, sorted by address in thread's areas
+ */
+bool insert_area( struct vm_area *area );
+void remove_area( struct vm_area *area );
+struct vm_area* find_area( const void *vaddr );
+struct vm_area* split_area( struct vm_area *area, void *at,
+                            struct file *file );
+void join_area( struct vm_area *area, struct vm_area *tail );
+bool extend_area( struct vm_area *area, void *start );
+
 /*
  * Assignment 12 : memory-mapped file
  */
@@ -48,7 +93,7 @@ struct mmap_file
   int map_id;                         /* identifier */
   struct file *file;                  /* mapped file */
   struct list_elem elem;              /* list elem for thread's mmap_list */
-  struct list vme_list;               /* list of vme for file */
+  struct vm_area *area;               /* region mapped, NULL if empty */
 };
 
 void do_munmap( struct mmap_file *mmap_file );
@@ -62,6 +107,27 @@ struct page
   void* kaddr;                        /* physical page address */
   struct list_elem lru_elem;          /* element for lru_list */
   struct thread* thread;              /* thread using this page */
+
+  bool is_hot;                        /* CLOCK-Pro : hot page? */
+  bool in_test;                       /* CLOCK-Pro : in test period? */
+
+  bool is_readahead;                  /* read ahead from swap, not mapped */
+
+  /* read-only executable page, shared by all processes running it. */
+  bool in_cache;                      /* in text page cache? */
+  struct hash_elem cache_elem;        /* element for text page cache */
+  block_sector_t sector;              /* executable's inode sector */
+  size_t offset;                      /* offset in executable */
+  struct list sharers;                /* vm_entries mapping this page */
+
+  /* private page shared read-only by parent and child since fork. */
+  bool is_cow;                        /* copy on write? */
+
+  bool in_table;                      /* in use, linked to its vme */
+  bool is_pending;                    /* on pending_list, not in policy */
+  bool is_referenced;                 /* accessed bit taken by sampler */
+  bool is_victim;                     /* gathered by evictor, off lists */
+  bool in_flush;                      /* being written back, pinned */
 };
 
 void lru_init( void );
@@ -69,4 +135,90 @@ void add_page_to_list( struct page* page );
 void delete_page_from_list( struct page* page );
 struct page* alloc_page( enum palloc_flags flag );
 void free_page( struct page* page );
+void free_vme_page( struct vm_entry* vme );
+bool wait_for_eviction( struct vm_entry* vme );
+
+/*
+ * Text page cache
+ */
+bool map_shared_page( struct vm_entry* vme );
+
+/*
+ * Copy-on-write fork
+ */
+bool fork_vme( struct vm_entry* vme, struct vm_entry* parent );
+bool break_cow( struct vm_entry* vme );
+
+/*
+ * Shared zero frame
+ */
+bool map_zero_page( struct vm_entry* vme );
+void unmap_zero_page( struct vm_entry* vme );
+
+/*
+ * Fault-around, window from "-faultaround=PAGES"
+ */
+extern size_t fault_around_pages;
+void fault_around( struct vm_entry* vme );
+
+/*
+ * Superpages, off with "-nosuperpage"
+ */
+extern bool superpage_enabled;
+bool map_superpage( struct vm_entry* vme );
+bool split_superpages( void );
+
+/*
+ * Access hints, from madvise()
+ */
+bool vm_advise( void* addr, size_t length, int advice );
+
+/*
+ * Swap readahead
+ */
+bool map_readahead_page( struct vm_entry* vme );
+void swap_readahead( struct vm_entry* vme );
+
+/*
+ * Page replacement policy, chosen by "-vmpolicy=NAME"
+ */
+bool vm_set_policy( const char* name );
+void vm_print_stats( void );
+
+/*
+ * Page-out daemon
+ */
+void pageout_init( void );
+
+/*
+ * Write-back of mapped files : flusher every "-flush=SECS" seconds,
+ * and msync()
+ */
+extern int flush_secs;
+void flusher_init( void );
+void vm_msync( struct vm_area *area );
+
+/*
+ * Pinning buffers of system calls
+ */
+bool vm_pin( void* addr, size_t size, bool write );
+void vm_unpin( void* addr, size_t size );
+
+/*
+ * Working-set sampler every "-wss=SECS" seconds, and resident sets
+ * of processes
+ */
+extern int ws_secs;
+void ws_init( void );
+
+/* smallest resident-set limit : room for code, stack, a system
+   call's pinned buffer and a batch of evictions. */
+#define RSS_LIMIT_MIN 32
+
+/*
+ * Frame table : page descriptors indexed by physical frame number
+ */
+struct page* find_page( void* kaddr );
+
 
+#endif /* vm/page.h */
@@ -1,54 +1,175 @@
 #include "vm/swap.h"
 #include <kernel/bitmap.h>
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/vaddr.h"
 #include "threads/synch.h"
 #include "devices/block.h"
 #include "userprog/syscall.h"
+#include "vm/zswap.h"
+
+/* block size is 512, page size is 4KB */
+#define SECTORS_PER_PAGE ( PGSIZE / BLOCK_SECTOR_SIZE )
+
+/* pages written by one disk request at most. */
+#define BOUNCE_PAGES 8
+
+/* swap device, NULL if there is none. */
+static struct block* swap_block;
 
 /* bitmap represents for swap slot */
 struct bitmap* slots;
 
+/* references to each slot. slot is free when it drops to 0. */
+static uint16_t* slot_refs;
+
+/* number of slots, and of slots in use. */
+static size_t slot_cnt;
+static size_t used_cnt;
+
+/* next-fit : where the next search starts. */
+static size_t slot_cursor;
+
+/* allocations refused because swap was full. */
+static unsigned long long full_cnt;
+
+/* run of pages copied together for one write. swap_lock. */
+static uint8_t* bounce;
+
 /* lock for swap */
 struct lock swap_lock;
 
+static size_t alloc_slots( size_t cnt );
+static void write_slot( size_t slot, const void* kaddr );
+static void write_run( size_t slot, size_t cnt );
+
 /*
- * Assignment 13 : creates bitmap
+ * Assignment 13 : creates bitmap, sized from swap device
  */
 void swap_init()
 {
-  slots = bitmap_create( 1024*8 );
-  bitmap_set_all( slots, false );
   lock_init( &swap_lock );
+
+  swap_block = block_get_role( BLOCK_SWAP );
+  if( swap_block == NULL )
+    return;
+
+  slot_cnt = block_size( swap_block ) / SECTORS_PER_PAGE;
+  slots = bitmap_create( slot_cnt );
+  slot_refs = calloc( slot_cnt, sizeof *slot_refs );
+  bounce = palloc_get_multiple( 0, BOUNCE_PAGES );
+  if( slots == NULL || slot_refs == NULL || bounce == NULL )
+    PANIC( "swap_init: cannot allocate %zu swap slots", slot_cnt );
+
+  /* compressed cache in front of the device. */
+  zswap_init( slot_cnt, write_slot );
+}
+
+/*
+ * write page to swap slot on device. swap_lock must be held.
+ */
+static void write_slot( size_t slot, const void* kaddr )
+{
+  block_write_multiple( swap_block, slot * SECTORS_PER_PAGE,
+                        SECTORS_PER_PAGE, kaddr );
+}
+
+/*
+ * write cnt pages in bounce to slots from slot on, with one
+ * request. swap_lock must be held.
+ */
+static void write_run( size_t slot, size_t cnt )
+{
+  block_write_multiple( swap_block, slot * SECTORS_PER_PAGE,
+                        cnt * SECTORS_PER_PAGE, bounce );
+}
+
+/*
+ * find cnt free consecutive slots, starting from cursor.
+ * returns first slot, or BITMAP_ERROR. swap_lock must be held.
+ */
+static size_t alloc_slots( size_t cnt )
+{
+  size_t slot, i;
+
+  if( slots == NULL || cnt > slot_cnt - used_cnt )
+    return BITMAP_ERROR;
+
+  /* next-fit : search from cursor to end, then from start. */
+  slot = bitmap_scan_and_flip( slots, slot_cursor, cnt, false );
+  if( slot == BITMAP_ERROR && slot_cursor != 0 )
+    slot = bitmap_scan_and_flip( slots, 0, cnt, false );
+  if( slot == BITMAP_ERROR )
+    return BITMAP_ERROR;
+
+  for( i=0; i<cnt; i++ )
+    slot_refs[slot+i] = 1;
+  used_cnt += cnt;
+
+  slot_cursor = slot + cnt;
+  if( slot_cursor >= slot_cnt )
+    slot_cursor = 0;
+
+  return slot;
 }
 
 /*
  * Assignment 13 : page block to swap slot
+ * returns BITMAP_ERROR if swap is full.
  */
 size_t swap_out( void *kaddr )
 {
-  struct block *swap_block;
-  size_t swap_slot;
-  int i;
+  return swap_out_cluster( &kaddr, 1 );
+}
 
-  /* get block for swap */
-  swap_block = block_get_role( BLOCK_SWAP );
+/*
+ * write cnt pages to consecutive swap slots. pages the compressed
+ * cache does not take are copied side by side and written with
+ * one disk request per run, of up to BOUNCE_PAGES.
+ * returns first slot, page i is in slot (first + i).
+ * returns BITMAP_ERROR if there is no such run of free slots.
+ */
+size_t swap_out_cluster( void **kaddrs, size_t cnt )
+{
+  size_t swap_slot;
+  size_t i, run = 0;
 
   lock_acquire( &swap_lock );
 
-  /* get empty(false) slot, set to 1 */
-  swap_slot = bitmap_scan_and_flip( slots, 0, 1, false );
+  /* get empty slots, referenced once */
+  swap_slot = alloc_slots( cnt );
 
-  /* multiply by 8 : block size is 512, page size is 4KB */
-  swap_slot *= 8;
-
-  /* store on swap area */
-  for( i=0; i<8; i++ )
+  /* store on swap area. run : pages in bounce, for the slots
+     just before slot i. */
+  if( swap_slot != BITMAP_ERROR )
   {
-    block_write( swap_block, swap_slot+i, kaddr+(BLOCK_SECTOR_SIZE*i) );
+    for( i=0; i<cnt; i++ )
+    {
+      /* compressed : ends run. */
+      if( zswap_store( swap_slot+i, kaddrs[i] ) )
+      {
+        if( run > 0 )
+          write_run( swap_slot+i-run, run );
+        run = 0;
+        continue;
+      }
+
+      memcpy( bounce + run * PGSIZE, kaddrs[i], PGSIZE );
+      if( ++run == BOUNCE_PAGES )
+      {
+        write_run( swap_slot+i+1-run, run );
+        run = 0;
+      }
+    }
+    if( run > 0 )
+      write_run( swap_slot+cnt-run, run );
   }
-
-  /* return to original */
-  swap_slot /= 8;
+  else
+    full_cnt++;
 
   lock_release( &swap_lock );
 
@@ -60,28 +181,67 @@ size_t swap_out( void *kaddr )
  */
 void swap_in( size_t index, void* kaddr )
 {
-  struct block *swap_block;
-  int i;
+  swap_read( index, kaddr );
+  swap_free( index );
+}
 
-  /* get block for swap */
-  swap_block = block_get_role( BLOCK_SWAP );
+/*
+ * read swap slot into memory, keeping the slot.
+ */
+void swap_read( size_t index, void* kaddr )
+{
+  lock_acquire( &swap_lock );
+
+  ASSERT( index < slot_cnt && slot_refs[index] > 0 );
 
+  /* load on kaddr, from compressed cache if there. */
+  if( zswap_load( index, kaddr ) == false )
+    block_read_multiple( swap_block, index * SECTORS_PER_PAGE,
+                         SECTORS_PER_PAGE, kaddr );
+
+  lock_release( &swap_lock );
+}
+
+/*
+ * add reference to swap slot, for sharing it.
+ */
+void swap_dup( size_t index )
+{
   lock_acquire( &swap_lock );
 
-  /* set bitmap into false */
-  bitmap_set_multiple( slots, index, 1, false );
+  ASSERT( index < slot_cnt && slot_refs[index] > 0 );
+  ASSERT( slot_refs[index] < UINT16_MAX );
+  slot_refs[index]++;
+
+  lock_release( &swap_lock );
+}
 
-  /* multiply by 8 */
-  index *= 8;
+/*
+ * drop reference to swap slot. last one releases it.
+ */
+void swap_free( size_t index )
+{
+  lock_acquire( &swap_lock );
 
-  /* load on kaddr */
-  for( i=0; i<8; i++ )
+  ASSERT( index < slot_cnt && slot_refs[index] > 0 );
+
+  /* set bitmap into false */
+  if( --slot_refs[index] == 0 )
   {
-    block_read( swap_block, index+i, kaddr+(BLOCK_SECTOR_SIZE*i) );
+    zswap_invalidate( index );
+    bitmap_reset( slots, index );
+    used_cnt--;
   }
 
   lock_release( &swap_lock );
 }
 
-
-
+/*
+ * print swap usage.
+ */
+void swap_print_stats( void )
+{
+  printf( "Swap: %zu of %zu slots in use, %llu allocations refused\n",
+          used_cnt, slot_cnt, full_cnt );
+  zswap_print_stats();
+}
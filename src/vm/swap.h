@@ -3,3 +3,8 @@
 void swap_init( void );
 void swap_in( size_t index, void* kaddr );
 size_t swap_out( void* kaddr );
+size_t swap_out_cluster( void** kaddrs, size_t cnt );
+void swap_read( size_t index, void* kaddr );
+void swap_dup( size_t index );
+void swap_free( size_t index );
+void swap_print_stats( void );
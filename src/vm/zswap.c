@@ -0,0 +1,448 @@
+#include "vm/zswap.h"
+#include <debug.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/*
+ * Compressed swap cache.
+ *
+ * Pages on their way to swap are compressed into a fixed arena of
+ * kernel pages, instead of being written to the swap device.  The
+ * cache is keyed by swap slot, so the slot is still reserved on the
+ * device : when the arena is full, the oldest arena page is
+ * decompressed and written to the slots it holds, and reused.
+ * Pages that do not shrink to ZSWAP_MAX_SIZE go straight to disk.
+ *
+ * Each arena page holds at most two compressed pages ("buddies"),
+ * one from its start and one from its end, so there is no
+ * fragmentation to manage.
+ *
+ * The compressor is LZ77 in the style of LZ4 : sequences of a
+ * token (literal length, match length), literals, and a 16-bit
+ * match offset.  All calls are made with swap_lock held.
+ */
+
+/* compressed size above which a page is not cached. */
+#define ZSWAP_MAX_SIZE ( PGSIZE * 3 / 4 )
+
+/* compressor : shortest match, hash table size. */
+#define MIN_MATCH 4
+#define HASH_BITS 12
+
+/* arena page holding up to two compressed pages. */
+struct zpage
+{
+  struct list_elem elem;              /* element for used or free list */
+  uint8_t* kaddr;                     /* arena memory */
+  size_t slot[2];                     /* swap slot of each buddy */
+  uint16_t size[2];                   /* compressed size, 0 if empty */
+};
+
+/* arena size in pages, from "-zswap=PAGES". 0 disables the cache. */
+size_t zswap_pages;
+
+static struct zpage* zpages;          /* arena page descriptors */
+static size_t zpage_cnt;              /* number of arena pages */
+static struct list used_list;         /* pages holding data, oldest first */
+static struct list free_list;         /* empty pages */
+
+/* per swap slot : zpage index * 2 + buddy + 1, or 0 if not cached. */
+static uint32_t* slot_map;
+static size_t slot_cnt;
+
+/* where to write pages pushed out of the cache. */
+static void (*writeback)( size_t slot, const void* kaddr );
+
+/* scratch : compression output, decompression for writeback. */
+static uint8_t* cbuf;
+static uint8_t* bounce;
+
+/* compressor hash table : position + 1, or 0. */
+static uint16_t hash_table[1 << HASH_BITS];
+
+/* statistics. */
+static unsigned long long store_cnt;       /* pages stored */
+static unsigned long long reject_cnt;      /* did not compress */
+static unsigned long long hit_cnt;         /* loads from cache */
+static unsigned long long miss_cnt;        /* loads from disk */
+static unsigned long long writeback_cnt;   /* pushed out to disk */
+static size_t stored_cnt;                  /* pages in cache now */
+static size_t stored_bytes;                /* their compressed size */
+
+static size_t lz_compress( const uint8_t* src, size_t n,
+                           uint8_t* dst, size_t cap );
+static bool lz_decompress( const uint8_t* src, size_t n,
+                           uint8_t* dst, size_t cap );
+static void push_out( struct zpage* zp );
+static void drop( size_t slot );
+
+/*
+ * set up arena for swap device with slots swap slots.
+ * pages pushed out of the cache are written with wb.
+ */
+void zswap_init( size_t slots, void (*wb)( size_t slot, const void* kaddr ) )
+{
+  list_init( &used_list );
+  list_init( &free_list );
+  writeback = wb;
+
+  if( zswap_pages == 0 || slots == 0 )
+    return;
+
+  slot_cnt = slots;
+  slot_map = calloc( slot_cnt, sizeof *slot_map );
+  zpages = calloc( zswap_pages, sizeof *zpages );
+  cbuf = palloc_get_page( 0 );
+  bounce = palloc_get_page( 0 );
+  if( slot_map == NULL || zpages == NULL || cbuf == NULL || bounce == NULL )
+    PANIC( "zswap_init: out of memory" );
+
+  /* take what the kernel pool can give. */
+  for( zpage_cnt=0; zpage_cnt<zswap_pages; zpage_cnt++ )
+  {
+    struct zpage* zp = &zpages[zpage_cnt];
+
+    zp->kaddr = palloc_get_page( 0 );
+    if( zp->kaddr == NULL )
+      break;
+    list_push_back( &free_list, &zp->elem );
+  }
+}
+
+/*
+ * compress page at kaddr into the cache as swap slot.
+ * returns false if it is not cached : caller writes it to disk.
+ */
+bool zswap_store( size_t slot, const void* kaddr )
+{
+  struct list_elem* e;
+  struct zpage* zp = NULL;
+  size_t clen;
+  int b;
+
+  if( zpage_cnt == 0 )
+    return false;
+
+  ASSERT( slot < slot_cnt && slot_map[slot] == 0 );
+
+  clen = lz_compress( kaddr, PGSIZE, cbuf, ZSWAP_MAX_SIZE );
+  if( clen == 0 )
+  {
+    reject_cnt++;
+    return false;
+  }
+
+  /* first, a half-used page with room. */
+  for( e = list_begin( &used_list ); e != list_end( &used_list );
+       e = list_next( e ) )
+  {
+    struct zpage* p = list_entry( e, struct zpage, elem );
+
+    if( ( p->size[0] == 0 || p->size[1] == 0 )
+        && p->size[0] + p->size[1] + clen <= PGSIZE )
+    {
+      zp = p;
+      break;
+    }
+  }
+
+  /* then an empty page, pushing out the oldest if there is none. */
+  if( zp == NULL )
+  {
+    if( list_empty( &free_list ) )
+      push_out( list_entry( list_front( &used_list ), struct zpage, elem ) );
+
+    zp = list_entry( list_pop_front( &free_list ), struct zpage, elem );
+    list_push_back( &used_list, &zp->elem );
+  }
+
+  /* buddy 0 from start, buddy 1 from end. */
+  b = ( zp->size[0] == 0 ) ? 0 : 1;
+  memcpy( zp->kaddr + ( b == 0 ? 0 : PGSIZE - clen ), cbuf, clen );
+  zp->slot[b] = slot;
+  zp->size[b] = clen;
+  slot_map[slot] = ( zp - zpages ) * 2 + b + 1;
+
+  store_cnt++;
+  stored_cnt++;
+  stored_bytes += clen;
+
+  return true;
+}
+
+/*
+ * read swap slot from the cache into kaddr.
+ * returns false if it is not cached : caller reads the disk.
+ */
+bool zswap_load( size_t slot, void* kaddr )
+{
+  struct zpage* zp;
+  uint32_t m;
+  int b;
+
+  if( zpage_cnt == 0 )
+    return false;
+
+  m = slot_map[slot];
+  if( m == 0 )
+  {
+    miss_cnt++;
+    return false;
+  }
+
+  zp = &zpages[(m - 1) / 2];
+  b = (m - 1) % 2;
+  if( !lz_decompress( zp->kaddr + ( b == 0 ? 0 : PGSIZE - zp->size[b] ),
+                      zp->size[b], kaddr, PGSIZE ) )
+    PANIC( "zswap: slot %zu is corrupt", slot );
+
+  hit_cnt++;
+  return true;
+}
+
+/*
+ * swap slot was freed : forget it.
+ */
+void zswap_invalidate( size_t slot )
+{
+  if( zpage_cnt != 0 && slot_map[slot] != 0 )
+    drop( slot );
+}
+
+/*
+ * print cache statistics.
+ */
+void zswap_print_stats( void )
+{
+  if( zpage_cnt == 0 )
+    return;
+
+  printf( "Zswap: %llu stored, %llu rejected, %llu hits, %llu misses, "
+          "%llu written back\n",
+          store_cnt, reject_cnt, hit_cnt, miss_cnt, writeback_cnt );
+  printf( "Zswap: %zu pages in %zu of %zu arena pages, "
+          "%zu%% of original size\n",
+          stored_cnt, zpage_cnt - list_size( &free_list ), zpage_cnt,
+          stored_cnt ? stored_bytes * 100 / ( stored_cnt * PGSIZE ) : 0 );
+}
+
+/*
+ * remove slot's data from its arena page.
+ */
+static void drop( size_t slot )
+{
+  uint32_t m = slot_map[slot];
+  struct zpage* zp = &zpages[(m - 1) / 2];
+  int b = (m - 1) % 2;
+
+  stored_cnt--;
+  stored_bytes -= zp->size[b];
+  zp->size[b] = 0;
+  slot_map[slot] = 0;
+
+  /* both buddies empty : page is free. */
+  if( zp->size[0] == 0 && zp->size[1] == 0 )
+  {
+    list_remove( &zp->elem );
+    list_push_back( &free_list, &zp->elem );
+  }
+}
+
+/*
+ * write arena page's buddies to disk, freeing it.
+ */
+static void push_out( struct zpage* zp )
+{
+  int b;
+
+  for( b=0; b<2; b++ )
+  {
+    size_t slot = zp->slot[b];
+
+    if( zp->size[b] == 0 )
+      continue;
+
+    if( !lz_decompress( zp->kaddr + ( b == 0 ? 0 : PGSIZE - zp->size[b] ),
+                        zp->size[b], bounce, PGSIZE ) )
+      PANIC( "zswap: slot %zu is corrupt", slot );
+    writeback( slot, bounce );
+    writeback_cnt++;
+    drop( slot );
+  }
+}
+
+/*
+ * compressor helpers.
+ */
+static inline uint32_t read32( const uint8_t* p )
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static inline size_t hash32( uint32_t x )
+{
+  return ( x * 2654435761u ) >> ( 32 - HASH_BITS );
+}
+
+/*
+ * append length extension bytes for len (>= 15) at dst[*o].
+ */
+static bool put_length( uint8_t* dst, size_t* o, size_t cap, size_t len )
+{
+  for( len -= 15; ; len -= 255 )
+  {
+    if( *o >= cap )
+      return false;
+    dst[(*o)++] = len < 255 ? len : 255;
+    if( len < 255 )
+      return true;
+  }
+}
+
+/*
+ * append one sequence : literals src[lit..lit+lit_len), then a
+ * match of match_len at offset, unless match_len is 0 (last one).
+ */
+static bool put_sequence( uint8_t* dst, size_t* o, size_t cap,
+                          const uint8_t* lit, size_t lit_len,
+                          size_t offset, size_t match_len )
+{
+  size_t ml = match_len ? match_len - MIN_MATCH : 0;
+
+  if( *o >= cap )
+    return false;
+  dst[(*o)++] = ( lit_len < 15 ? lit_len : 15 ) << 4 | ( ml < 15 ? ml : 15 );
+  if( lit_len >= 15 && !put_length( dst, o, cap, lit_len ) )
+    return false;
+
+  if( *o + lit_len > cap )
+    return false;
+  memcpy( dst + *o, lit, lit_len );
+  *o += lit_len;
+
+  if( match_len == 0 )
+    return true;
+
+  if( *o + 2 > cap )
+    return false;
+  dst[(*o)++] = offset;
+  dst[(*o)++] = offset >> 8;
+  return ml < 15 || put_length( dst, o, cap, ml );
+}
+
+/*
+ * compress n bytes (n < 65536) of src into at most cap bytes of dst.
+ * returns compressed size, or 0 if it does not fit.
+ */
+static size_t lz_compress( const uint8_t* src, size_t n,
+                           uint8_t* dst, size_t cap )
+{
+  size_t ip = 0, anchor = 0, o = 0;
+
+  memset( hash_table, 0, sizeof hash_table );
+
+  while( ip + MIN_MATCH <= n )
+  {
+    uint32_t x = read32( src + ip );
+    size_t h = hash32( x );
+    size_t ref = hash_table[h];
+
+    hash_table[h] = ip + 1;
+
+    /* candidate : earlier position with the same 4 bytes. */
+    if( ref != 0 && read32( src + ref - 1 ) == x )
+    {
+      size_t len = MIN_MATCH;
+
+      ref--;
+      while( ip + len < n && src[ref + len] == src[ip + len] )
+        len++;
+
+      if( !put_sequence( dst, &o, cap, src + anchor, ip - anchor,
+                         ip - ref, len ) )
+        return 0;
+      ip += len;
+      anchor = ip;
+    }
+    else
+      ip++;
+  }
+
+  /* rest as literals. */
+  if( !put_sequence( dst, &o, cap, src + anchor, n - anchor, 0, 0 ) )
+    return 0;
+  return o;
+}
+
+/*
+ * read length extension bytes into *len.
+ */
+static bool get_length( const uint8_t* src, size_t* i, size_t n,
+                        size_t* len )
+{
+  uint8_t b;
+
+  do
+  {
+    if( *i >= n )
+      return false;
+    b = src[(*i)++];
+    *len += b;
+  }
+  while( b == 255 );
+
+  return true;
+}
+
+/*
+ * decompress n bytes of src into exactly cap bytes of dst.
+ * returns false if src is malformed.
+ */
+static bool lz_decompress( const uint8_t* src, size_t n,
+                           uint8_t* dst, size_t cap )
+{
+  size_t i = 0, o = 0;
+
+  while( i < n )
+  {
+    uint8_t token = src[i++];
+    size_t lit_len = token >> 4;
+    size_t match_len = token & 15;
+    size_t offset;
+
+    /* literals */
+    if( lit_len == 15 && !get_length( src, &i, n, &lit_len ) )
+      return false;
+    if( lit_len > n - i || lit_len > cap - o )
+      return false;
+    memcpy( dst + o, src + i, lit_len );
+    i += lit_len;
+    o += lit_len;
+
+    /* last sequence has no match. */
+    if( i == n )
+      break;
+
+    /* match */
+    if( n - i < 2 )
+      return false;
+    offset = src[i] | src[i + 1] << 8;
+    i += 2;
+    if( match_len == 15 && !get_length( src, &i, n, &match_len ) )
+      return false;
+    match_len += MIN_MATCH;
+    if( offset == 0 || offset > o || match_len > cap - o )
+      return false;
+
+    /* byte by byte : source may overlap destination. */
+    for( ; match_len > 0; match_len--, o++ )
+      dst[o] = dst[o - offset];
+  }
+
+  return o == cap;
+}
@@ -0,0 +1,16 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* arena size in pages, from "-zswap=PAGES". */
+extern size_t zswap_pages;
+
+void zswap_init( size_t slots, void (*wb)( size_t slot, const void* kaddr ) );
+bool zswap_store( size_t slot, const void* kaddr );
+bool zswap_load( size_t slot, void* kaddr );
+void zswap_invalidate( size_t slot );
+void zswap_print_stats( void );
+
+#endif /* vm/zswap.h */